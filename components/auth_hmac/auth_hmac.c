@@ -4,23 +4,31 @@
 
 #include "esp_log.h"
 #include "esp_random.h"
-#include "mbedtls/md.h"
+#include "mbedtls/sha256.h"
+#include "mbedtls/constant_time.h"
+#include "mbedtls/platform_util.h"
 #include "auth_hmac.h"
 
 
 #define HMAC_SHA256_LEN     (32U) // SHA-256 produces a 32-byte hash
+#define HMAC_BLOCK_LEN      (64U) // SHA-256 block size, longer than any pre-shared key
+#define HMAC_IPAD           (0x36U)
+#define HMAC_OPAD           (0x5CU)
 
 
 static const char *tag = "AUTH_HMAC";
 
+/* SHA-256 states after the ipad and opad blocks, each verification clones them instead of re-keying */
 static struct {
-    uint8_t val[AUTH_HMAC_MAX_BUFFER_LEN];
-    size_t len;
+    mbedtls_sha256_context inner;
+    mbedtls_sha256_context outer;
     bool is_set;
 } psk = { .is_set = false };
 
+static int absorb_pad(mbedtls_sha256_context * p_ctx, const uint8_t * key, const size_t len, const uint8_t pad);
+
 /**
- * @brief pre-shared key setter
+ * @brief pre-shared key setter, the key schedule is computed once here
  * 
  * @param key [in]: pre-shared key
  * @param len [in]: pre-shared key length in bytes
@@ -39,8 +47,18 @@ types_error_code_e auth_hmac_set_hmac_psk(const uint8_t *key, const size_t len)
         return ERR_CODE_INVALID_PARAM;
     }
 
-    memcpy(psk.val, key, len);
-    psk.len = len;
+    mbedtls_sha256_init(&psk.inner);
+    mbedtls_sha256_init(&psk.outer);
+
+    if ((absorb_pad(&psk.inner, key, len, HMAC_IPAD) != 0) || 
+        (absorb_pad(&psk.outer, key, len, HMAC_OPAD) != 0))
+    {
+        ESP_LOGE(tag, "----- Error during HMAC key schedule -----");
+        mbedtls_sha256_free(&psk.inner);
+        mbedtls_sha256_free(&psk.outer);
+        return ERR_CODE_FAIL;
+    }
+
     psk.is_set = true;
     ESP_LOGI(tag, "----- Shared key has set -----");
 
@@ -78,36 +96,41 @@ bool auth_hmac_verify_response(const uint8_t *nonce, size_t nonce_len, const uin
         return false;
     }
 
-    uint8_t calculated_hmac[HMAC_SHA256_LEN] = {0};
-    const mbedtls_md_info_t *md_info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256); // Use SHA-256 for HMAC
-    if (md_info == NULL)
+    if (psk.is_set == false)
     {
-        ESP_LOGE(tag, "----- mbedtls_md_info_from_type failed -----");
+        ESP_LOGE(tag, "----- Shared key not set -----");
         return false;
     }
 
-    mbedtls_md_context_t ctx;
-    mbedtls_md_init(&ctx);
+    uint8_t calculated_hmac[HMAC_SHA256_LEN] = {0};
 
-    if (mbedtls_md_setup(&ctx, md_info, 1) != 0) // enable HMAC
-    {
-        ESP_LOGE(tag, "----- mbedtls_md_setup failed -----");
-        mbedtls_md_free(&ctx);
-        return false;
-    }
+    /* Clones keep concurrent connections from sharing a hash state */
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_clone(&ctx, &psk.inner);
+
+    int ret = mbedtls_sha256_update(&ctx, nonce, nonce_len); // Update with nonce
+    ret = (ret != 0) ? ret : mbedtls_sha256_finish(&ctx, calculated_hmac);
+
+    mbedtls_sha256_free(&ctx);
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_clone(&ctx, &psk.outer);
 
-    if (mbedtls_md_hmac_starts(&ctx, psk.val, psk.len) != 0 ||
-        mbedtls_md_hmac_update(&ctx, nonce, nonce_len) != 0 || // Update with nonce
-        mbedtls_md_hmac_finish(&ctx, calculated_hmac) != 0) // Compute HMAC
+    ret = (ret != 0) ? ret : mbedtls_sha256_update(&ctx, calculated_hmac, sizeof(calculated_hmac));
+    ret = (ret != 0) ? ret : mbedtls_sha256_finish(&ctx, calculated_hmac); // Compute HMAC
+
+    mbedtls_sha256_free(&ctx);
+
+    if (ret != 0)
     {
         ESP_LOGE(tag, "----- Error during HMAC computation -----");
-        mbedtls_md_free(&ctx);
         return false;
     }
 
-    mbedtls_md_free(&ctx); 
+    /* Constant time, the time taken does not tell how many leading bytes matched */
+    bool valid = mbedtls_ct_memcmp(received_hmac, calculated_hmac, HMAC_SHA256_LEN) == 0;
 
-    bool valid = memcmp(received_hmac, calculated_hmac, HMAC_SHA256_LEN) == 0; // Compare received HMAC with calculated HMAC memories
+    mbedtls_platform_zeroize(calculated_hmac, sizeof(calculated_hmac));
 
     if (valid)
         ESP_LOGI(tag, "----- HMAC successfully verified -----");
@@ -116,3 +139,41 @@ bool auth_hmac_verify_response(const uint8_t *nonce, size_t nonce_len, const uin
 
     return valid;
 }
+
+/**
+ * @brief Hash the key XORed with an HMAC pad into a context left open for the message
+ * 
+ * @param p_ctx [out]: Initialized SHA-256 context
+ * @param key [in]: pre-shared key
+ * @param len [in]: pre-shared key length in bytes, at most HMAC_BLOCK_LEN
+ * @param pad [in]: HMAC_IPAD or HMAC_OPAD
+ * @return int 0 on success, mbedtls error otherwise
+ */
+static int absorb_pad(mbedtls_sha256_context * p_ctx, const uint8_t * key, const size_t len, const uint8_t pad)
+{
+    uint8_t block[HMAC_BLOCK_LEN];
+    memset(block, pad, sizeof(block));
+
+    for (size_t i = 0; i < len; i++)
+    {
+        block[i] ^= key[i];
+    }
+
+    /* Hashed in a temporary context then cloned: the clone is a software copy of the state, so a
+     * context kept for the whole uptime does not hold the SHA accelerator away from the image hashing */
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+
+    int ret = mbedtls_sha256_starts(&ctx, 0);
+    ret = (ret != 0) ? ret : mbedtls_sha256_update(&ctx, block, sizeof(block));
+
+    if (ret == 0)
+    {
+        mbedtls_sha256_clone(p_ctx, &ctx);
+    }
+
+    mbedtls_sha256_free(&ctx);
+    mbedtls_platform_zeroize(block, sizeof(block));
+
+    return ret;
+}
@@ -7,14 +7,41 @@
 #include "types.h"
 
 
-#define MSG_PARSER_BUF_LEN_BYTES    (10U)
+#define MSG_PARSER_BUF_LEN_BYTES    (255U) /* Fits every ack a single read may owe, ack lengths are 8 bits */
+#define MSG_PARSER_MAX_WINDOW_BYTES (16384U) /* Bytes an extended client may keep unacknowledged */
+#define MSG_PARSER_MAX_SESSIONS     (2U) /* Connections parsed at once, only one of them may run an update */
+
+typedef struct msg_parser_session msg_parser_session_t;
+
+/* Called from the ota_writer tasks when the running update fails, must not block */
+typedef void (*msg_parser_fault_cb_t)(void);
 
 
 types_error_code_e msg_parser_init(void);
 
-types_error_code_e msg_parser_run(const uint8_t * p_data, const uint16_t len, uint32_t * p_out_bytes_read);
+types_error_code_e msg_parser_open_session(msg_parser_session_t ** pp_session);
+
+void msg_parser_close_session(msg_parser_session_t * p_session);
+
+types_error_code_e msg_parser_run(msg_parser_session_t * p_session, 
+                                  const uint8_t * p_data, 
+                                  const uint16_t len, 
+                                  uint32_t * p_out_bytes_read);
+
+types_error_code_e msg_parser_poll(msg_parser_session_t * p_session, uint32_t * p_out_bytes_read);
+
+void msg_parser_set_fault_cb(msg_parser_fault_cb_t fault_cb);
+
+bool msg_parser_is_updating(const msg_parser_session_t * p_session);
+
+bool msg_parser_is_windowed(const msg_parser_session_t * p_session);
+
+types_error_code_e msg_parser_get_rx_buffer(msg_parser_session_t * p_session, uint8_t ** pp_buffer, uint16_t * p_len);
 
-void msg_parser_clean(void);
+types_error_code_e msg_parser_build_rx_ack(msg_parser_session_t * p_session, 
+                                           uint8_t * p_buffer, 
+                                           const uint8_t len, 
+                                           uint8_t * p_out_len);
 
 types_error_code_e msg_parser_build_firmware_ack(uint8_t * p_buffer, const uint8_t len, uint8_t * p_out_len);
 
@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 #include "ota_manager.h"
+#include "ota_writer.h"
+#include "ota_decompressor.h"
+#include "ota_delta.h"
+#include "ota_blocks.h"
+#include "ota_metrics.h"
+#include "ota_manifest.h"
 #include "sys_feedback.h"
 #include "msg_parser.h"
 
@@ -21,26 +28,143 @@
 /* ---------- FIRMWARE ACK PARAMETERS ---------- */
 #define FIRMWARE_ACK_SIZE_IN_BYTES          (4U)
 
+/* ----------- EXTENDED HEADER PARAMETERS -----------
+ * Frame: magic (4) | version (1) | type (1) | payload length (2) | payload
+ * OTA begin payload: flags (2) | firmware size (4) | hash (32) | [window (4)] | [stream size (4)] | [stream hash (32)]
+ *                    | [manifest]
+ * OTA begin ack payload: status (1) | window (4) | resume offset (4)
+ * Blocks ack payload: requested bytes (4) | bitmap of the requested blocks, see ota_blocks.h
+ * A status query has no payload and is only accepted between updates
+ * Headers may be split over several reads, and firmware data may follow a header in the same read.
+ * Clients asking to resume must wait for the OTA begin ack, which carries the offset to continue from.
+ * Clients setting the present flag must also wait for it: when a partition already holds the image, nothing
+ * is transferred. If it is the boot partition the ack reports it present, otherwise the boot partition is
+ * switched to it and the OTA ack follows, as if the image had been written.
+ * With the blocks flag the stream starts with the hash list of the image blocks. Once it is received the
+ * blocks ack tells which blocks to send next, the others are copied from flash. Data acks count the hash
+ * list bytes too.
+ * Fields are little endian and optional fields follow the order of their flag bits, the stream
+ * size is present for compressed and delta streams. The manifest takes the rest of the payload.
+ * Once a manifest public key is provisioned, only extended headers carrying a manifest signed for
+ * this firmware size and hash are accepted, and legacy headers are refused.
+ * The magic read as a firmware size is larger than any OTA partition, so it never
+ * collides with a legacy header.
+ */
+#define EXT_HEADER_MAGIC                    (0x5841544FUL) /* "OTAX" */
+#define EXT_HEADER_VERSION                  (1U)
+#define EXT_HEADER_PREFIX_SIZE_IN_BYTES     (8U)
+#define EXT_HEADER_TYPE_OTA_BEGIN           (0x01U)
+#define EXT_HEADER_TYPE_STATUS_QUERY        (0x02U) /* No payload, answered with the timings of the last update */
+
+#define EXT_FLAG_WINDOWED                   (1U << 0)
+#define EXT_FLAG_RESUME                     (1U << 1) /* Client asks where to continue an interrupted update */
+#define EXT_FLAG_COMPRESSED                 (1U << 2) /* Image sent as a zlib stream of stream size bytes */
+#define EXT_FLAG_STREAM_HASH                (1U << 3) /* SHA-256 of the compressed stream is also checked */
+#define EXT_FLAG_DELTA                      (1U << 4) /* Stream is a patch against the running partition */
+#define EXT_FLAG_MANIFEST                   (1U << 5) /* Signed manifest, see ota_manifest.h */
+#define EXT_FLAG_PRESENT                    (1U << 6) /* Skip the transfer of an image already in a partition */
+#define EXT_FLAG_BLOCKS                     (1U << 7) /* Block hash list first, then only the requested blocks */
+
+#define OTA_BEGIN_MIN_SIZE_IN_BYTES         (2U + FIRMWARE_LEN_SIZE_IN_BYTES + HASH_SIZE_IN_BYTES)
+#define WINDOW_SIZE_IN_BYTES                (4U)
+#define STREAM_SIZE_IN_BYTES                (4U)
+#define OTA_BEGIN_MAX_SIZE_IN_BYTES         (OTA_BEGIN_MIN_SIZE_IN_BYTES + WINDOW_SIZE_IN_BYTES + \
+                                             STREAM_SIZE_IN_BYTES + HASH_SIZE_IN_BYTES)
+#define EXT_HEADER_MAX_SIZE_IN_BYTES        (EXT_HEADER_PREFIX_SIZE_IN_BYTES + OTA_BEGIN_MAX_SIZE_IN_BYTES + \
+                                             OTA_MANIFEST_MAX_LEN)
+
+/* ------------ EXTENDED ACK PARAMETERS ------------
+ * Frame: marker (1) | type (1) | payload length (2) | payload
+ */
+#define EXT_ACK_MARKER                      (0xA5U)
+#define EXT_ACK_PREFIX_SIZE_IN_BYTES        (4U)
+#define EXT_ACK_TYPE_BEGIN                  (0x81U)
+#define EXT_ACK_TYPE_DATA                   (0x82U)
+#define EXT_ACK_TYPE_STATUS                 (0x83U) /* Payload built by ota_metrics_build_summary */
+#define EXT_ACK_TYPE_BLOCKS                 (0x84U)
+
+#define BEGIN_ACK_PAYLOAD_SIZE_IN_BYTES     (1U + WINDOW_SIZE_IN_BYTES + 4U)
+#define BEGIN_ACK_ACCEPTED                  (0U)
+#define BEGIN_ACK_REJECTED                  (1U)
+#define BEGIN_ACK_BAD_MANIFEST              (2U) /* Manifest missing, malformed or not signed by the provisioned key */
+#define BEGIN_ACK_BUSY                      (3U) /* Another session is running an update */
+#define BEGIN_ACK_PRESENT                   (4U) /* Image already in the boot partition, nothing to do */
+#define BEGIN_ACK_BOOT_SWITCHED             (5U) /* Image already in another partition, now the boot partition */
+#define DATA_ACK_PAYLOAD_SIZE_IN_BYTES      (4U)
+#define BLOCKS_ACK_NEEDED_SIZE_IN_BYTES     (4U)
+
+/* ---------------- PENDING ACKS ----------------
+ * A single read may owe several acks, they are sent in this bit order
+ */
+#define PENDING_ACK_NONE                    (0U)
+#define PENDING_ACK_FIRMWARE                (1U << 0)
+#define PENDING_ACK_BEGIN                   (1U << 1)
+#define PENDING_ACK_BLOCKS                  (1U << 2)
+#define PENDING_ACK_DATA                    (1U << 3)
+#define PENDING_ACK_STATUS                  (1U << 4)
+
 
 typedef enum {  
     READ_HEADER,
     START_OTA,
-    WRITE_FIRMWARE
+    WRITE_FIRMWARE,
+    DISCARD_STREAM     /* Header rejected or transfer failed, the rest of the stream is dropped until the connection closes */
 } msg_parser_states_e;
 
-typedef struct {
+typedef struct msg_parser_session {
+    bool is_open;
     msg_parser_states_e state;
     uint32_t firmware_size;
     uint32_t firmware_bytes_read;
     uint8_t hash[HASH_SIZE_IN_BYTES];
-    SemaphoreHandle_t semaphore;
+    uint32_t stream_size;
+    uint8_t stream_hash[HASH_SIZE_IN_BYTES];
+    bool is_extended;
+    uint16_t flags;
+    uint32_t window_size;
+    uint32_t acked_bytes;
+    uint32_t resume_offset;
+    uint8_t begin_status;
+    bool is_boot_switched;
+    bool is_block_plan_ready;
+    uint32_t block_needed_len;     /* Blocks ack, kept like the begin status since the update may end in the same read */
+    uint8_t block_bitmap[OTA_BLOCKS_BITMAP_MAX_LEN];
+    uint8_t block_bitmap_len;
+    uint8_t pending_acks;
+    uint8_t header[EXT_HEADER_MAX_SIZE_IN_BYTES];
+    uint16_t header_len;
 } state_machine_params_t;
 
-
-static state_machine_params_t state_machine_instance = {};
+/* Sessions are driven by their own connection task, only the session holding the OTA lock may
+ * touch the update pipeline. The semaphore guards the slots and the lock owner */
+static struct {
+    state_machine_params_t sessions[MSG_PARSER_MAX_SESSIONS];
+    state_machine_params_t *p_ota_owner;
+    SemaphoreHandle_t semaphore;
+} parser_instance = {};
 
 
+static types_error_code_e read_header(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len, uint16_t * p_out_consumed);
+static uint16_t get_header_target_len(state_machine_params_t * p_session);
+static types_error_code_e parse_header_frame(state_machine_params_t * p_session);
 static void parse_header(const uint8_t * p_data, uint32_t * p_firmware_size, uint8_t * p_hash);
+static types_error_code_e parse_ext_header(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len);
+static types_error_code_e check_manifest(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len, const uint32_t firmware_size);
+static bool use_present_image(state_machine_params_t * p_session);
+static bool is_status_query(const uint8_t * p_data, const uint16_t len);
+static types_error_code_e start_update(state_machine_params_t * p_session);
+static types_error_code_e push_stream(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len);
+static types_error_code_e finish_stream(state_machine_params_t * p_session);
+static void abort_stream(void);
+static types_error_code_e end_transfer(state_machine_params_t * p_session, const types_error_code_e result, uint32_t * p_out_bytes_read);
+static types_error_code_e check_block_plan(state_machine_params_t * p_session);
+static void update_data_ack(state_machine_params_t * p_session);
+static types_error_code_e build_ext_ack(state_machine_params_t * p_session, const uint8_t type, uint8_t * p_buffer, const uint8_t len, uint8_t * p_out_len);
+static void reset_params(state_machine_params_t * p_session);
+static bool take_ota_lock(state_machine_params_t * p_session);
+static void release_ota_lock(state_machine_params_t * p_session);
+static uint32_t get_u32_le(const uint8_t * p_data);
+static void put_u32_le(uint8_t * p_data, const uint32_t value);
 
 /**
  * @brief Initialize the msg_parser component
@@ -49,86 +173,174 @@ static void parse_header(const uint8_t * p_data, uint32_t * p_firmware_size, uin
  */
 types_error_code_e msg_parser_init(void)
 {
-    vSemaphoreCreateBinary(state_machine_instance.semaphore);
-    if (state_machine_instance.semaphore == NULL)
+    parser_instance.semaphore = xSemaphoreCreateMutex();
+    if (parser_instance.semaphore == NULL)
     {
         return ERR_CODE_FAIL;
     }
-    
-    state_machine_instance.state = READ_HEADER;
 
-    return ERR_CODE_OK;
+    types_error_code_e err = ota_metrics_init();
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
+
+    return ota_writer_init();
+}
+
+/**
+ * @brief Open a parser session for a new connection
+ * 
+ * @param pp_session [out]: Session, to be closed with msg_parser_close_session
+ * @return types_error_code_e ERR_CODE_NOT_ALLOWED when every session is in use
+ */
+types_error_code_e msg_parser_open_session(msg_parser_session_t ** pp_session)
+{
+    types_error_code_e err = ERR_CODE_NOT_ALLOWED;
+
+    xSemaphoreTake(parser_instance.semaphore, portMAX_DELAY);
+
+    for (uint8_t i = 0; i < MSG_PARSER_MAX_SESSIONS; i++)
+    {
+        state_machine_params_t *p_session = &parser_instance.sessions[i];
+
+        if (!p_session->is_open)
+        {
+            memset(p_session, 0, sizeof(*p_session));
+            p_session->is_open = true;
+            p_session->state = READ_HEADER;
+
+            *pp_session = p_session;
+            err = ERR_CODE_OK;
+            break;
+        }
+    }
+
+    xSemaphoreGive(parser_instance.semaphore);
+
+    return err;
 }
 
 /**
- * @brief Msg_parser state machine, responsible for parse the incoming messagens
+ * @brief Msg_parser state machine, responsible for parse the incoming messagens. A session is only 
+ * driven by the task serving its connection
  * 
+ * @param p_session [in]: Parser session
  * @param p_data [in]: Message data buffer
  * @param len [in]: Message data buffer length
  * @param p_out_bytes_read [out]: Number os bytes read
  * @return types_error_code_e 
  */
-types_error_code_e msg_parser_run(const uint8_t * p_data, const uint16_t len, uint32_t * p_out_bytes_read)
+types_error_code_e msg_parser_run(msg_parser_session_t * p_session, 
+                                  const uint8_t * p_data, 
+                                  const uint16_t len, 
+                                  uint32_t * p_out_bytes_read)
 {
-    xSemaphoreTake(state_machine_instance.semaphore, portMAX_DELAY);
-
     types_error_code_e status = ERR_CODE_IN_PROGRESS;
     
     *p_out_bytes_read = UINT32_MAX;
 
-    switch (state_machine_instance.state)
+    p_session->pending_acks = PENDING_ACK_NONE;
+
+    /* Whatever follows the header in the same read is firmware data */
+    uint16_t data_len = len;
+    if (p_session->state == READ_HEADER)
     {
-        case READ_HEADER:
-            if (len == HEADER_SIZE_IN_BYTES)
-            {
-                parse_header(p_data, &state_machine_instance.firmware_size, state_machine_instance.hash);
+        uint16_t consumed = 0;
 
-                state_machine_instance.state = START_OTA;
-            }
+        if (read_header(p_session, p_data, len, &consumed) != ERR_CODE_OK)
+        {
+            /* Legacy update refused, the OTA ack tells the client nothing was written */
+            *p_out_bytes_read = 0;
+            status = ERR_CODE_FAIL;
+        }
+        else if (p_session->is_boot_switched)
+        {
+            /* The image was already in flash, the OTA ack closes the update as if it was transferred */
+            *p_out_bytes_read = p_session->firmware_size;
+            p_session->is_boot_switched = false;
+            status = ERR_CODE_OK;
+        }
+
+        p_data += consumed;
+        data_len -= consumed;
+
+        /* A client streaming right behind the header cannot have read the resume offset yet */
+        if ((p_session->state == START_OTA) && (data_len > 0) && (p_session->resume_offset > 0))
+        {
+            p_session->resume_offset = 0;
+            p_session->firmware_bytes_read = 0;
+            p_session->acked_bytes = 0;
+        }
+    }
+
+    switch (p_session->state)
+    {
+        case READ_HEADER:
+        case DISCARD_STREAM:
         break;
 
         case START_OTA:
         {
-            if (ota_process_init(state_machine_instance.firmware_size, state_machine_instance.hash) != ERR_CODE_OK)
+            if (data_len == 0)
+            {
+                break;
+            }
+
+            types_error_code_e err = start_update(p_session);
+            if (err != ERR_CODE_OK)
             {
-                ota_process_end(false);
-                
-                types_error_code_e err = ota_process_init(state_machine_instance.firmware_size, state_machine_instance.hash);
-                if (err != ERR_CODE_OK)
-                {
-                    status = err;
-                    break;
-                }
+                ota_metrics_end_update(false);
+                release_ota_lock(p_session);
+                reset_params(p_session);
+
+                /* The firmware still on its way must not be parsed as a header */
+                p_session->state = DISCARD_STREAM;
+                status = err;
+                break;
             }
 
             sys_feedback_set_update_mode();
             
-            state_machine_instance.state = WRITE_FIRMWARE;
+            p_session->state = WRITE_FIRMWARE;
         }
             /* Fallthrough */
 
         case WRITE_FIRMWARE:
         {
-            state_machine_instance.firmware_bytes_read += len;
+            if (!p_session->is_extended)
+            {
+                p_session->pending_acks |= PENDING_ACK_FIRMWARE;
+            }
+
+            p_session->firmware_bytes_read += data_len;
+
+            types_error_code_e err = push_stream(p_session, p_data, data_len);
 
-            types_error_code_e err = ota_process_write_block(p_data, len);
+            if ((err == ERR_CODE_IN_PROGRESS) && ((p_session->flags & EXT_FLAG_BLOCKS) != 0))
+            {
+                err = check_block_plan(p_session);
+            }
+
+            if (err != ERR_CODE_IN_PROGRESS)
+            {
+                abort_stream();
+            }
+            else if (p_session->firmware_bytes_read > p_session->stream_size)
+            {
+                abort_stream();
+                err = ERR_CODE_FAIL;
+            }
+            else if (p_session->firmware_bytes_read == p_session->stream_size)
+            {
+                err = finish_stream(p_session);
+            }
+
+            update_data_ack(p_session);
 
             if ((err == ERR_CODE_OK) || (err == ERR_CODE_FAIL))
             {
-                /* Externalize firmware bytes read */
-                *p_out_bytes_read = state_machine_instance.firmware_bytes_read;
-
-                /* Clean parameters */
-                state_machine_instance.firmware_size = 0;
-                state_machine_instance.firmware_bytes_read = 0;
-                memset(state_machine_instance.hash, 0, sizeof(state_machine_instance.hash));
-
-                err = (err == ERR_CODE_OK)? ota_process_end(true) : ota_process_end(false);
-                
-                sys_feedback_set_normal_mode();
-                
-                state_machine_instance.state = READ_HEADER;
-                status = err;
+                status = end_transfer(p_session, err, p_out_bytes_read);
             }
         }
         break;
@@ -138,27 +350,122 @@ types_error_code_e msg_parser_run(const uint8_t * p_data, const uint16_t len, ui
         break;
     }
 
-    xSemaphoreGive(state_machine_instance.semaphore);
-
     return status;
 }
 
 /**
- * @brief Reset msg_parser state machine parameters
+ * @brief End an update whose flash write or verification failed in the background, without waiting for
+ * the next read. Meant to be called once the callback set by msg_parser_set_fault_cb fired
  * 
+ * @param p_session [in]: Parser session
+ * @param p_out_bytes_read [out]: Firmware bytes read, for the OTA ack
+ * @return types_error_code_e ERR_CODE_FAIL when the update was ended and its OTA ack is owed, 
+ * ERR_CODE_IN_PROGRESS otherwise
  */
-void msg_parser_clean(void)
+types_error_code_e msg_parser_poll(msg_parser_session_t * p_session, uint32_t * p_out_bytes_read)
 {
-    xSemaphoreTake(state_machine_instance.semaphore, portMAX_DELAY);
+    *p_out_bytes_read = UINT32_MAX;
 
-    state_machine_instance.state = READ_HEADER;
-    state_machine_instance.firmware_size = 0;
-    state_machine_instance.firmware_bytes_read = 0;
-    memset(state_machine_instance.hash, 0, sizeof(state_machine_instance.hash));
+    if ((p_session->state != WRITE_FIRMWARE) || (ota_writer_get_status() == ERR_CODE_IN_PROGRESS))
+    {
+        return ERR_CODE_IN_PROGRESS;
+    }
 
-    sys_feedback_set_normal_mode();
+    p_session->pending_acks = PENDING_ACK_NONE;
+    abort_stream();
+
+    return end_transfer(p_session, ERR_CODE_FAIL, p_out_bytes_read);
+}
+
+/**
+ * @brief Register the callback told, from the ota_writer tasks, that the running update failed
+ * 
+ * @param fault_cb [in]: Fault callback, must not block
+ */
+void msg_parser_set_fault_cb(msg_parser_fault_cb_t fault_cb)
+{
+    ota_writer_set_fault_cb(fault_cb);
+}
+
+/**
+ * @brief Close a session, an update it left unfinished is released so another session can resume it
+ * 
+ * @param p_session [in]: Parser session
+ */
+void msg_parser_close_session(msg_parser_session_t * p_session)
+{
+    if (p_session->state == WRITE_FIRMWARE)
+    {
+        /* Flush what was already queued and release the update, its checkpoint allows resuming it */
+        abort_stream();
+        ota_process_end(false);
+    }
+
+    if (parser_instance.p_ota_owner == p_session)
+    {
+        /* Closes a summary left open by a disconnection */
+        ota_metrics_end_update(false);
+        sys_feedback_set_normal_mode();
+        release_ota_lock(p_session);
+    }
 
-    xSemaphoreGive(state_machine_instance.semaphore);
+    p_session->state = READ_HEADER;
+    reset_params(p_session);
+
+    xSemaphoreTake(parser_instance.semaphore, portMAX_DELAY);
+    p_session->is_open = false;
+    xSemaphoreGive(parser_instance.semaphore);
+}
+
+/**
+ * @brief Check whether a session accepted an update and is waiting for its data
+ * 
+ * @param p_session [in]: Parser session
+ * @return true between an accepted header and the end of the update
+ */
+bool msg_parser_is_updating(const msg_parser_session_t * p_session)
+{
+    return ((p_session->state == START_OTA) || (p_session->state == WRITE_FIRMWARE));
+}
+
+/**
+ * @brief Check whether the firmware of a session is acked by window rather than on every read
+ * 
+ * @param p_session [in]: Parser session
+ * @return true when an extended header negotiated an ack window
+ */
+bool msg_parser_is_windowed(const msg_parser_session_t * p_session)
+{
+    return (p_session->window_size > 0);
+}
+
+/**
+ * @brief Get a buffer where the next read can land without being copied again. While raw firmware is being
+ * received it is the free space of the ota_writer block being filled, bounded to the bytes still expected
+ * 
+ * @param p_session [in]: Parser session
+ * @param pp_buffer [out]: Receive buffer
+ * @param p_len [out]: Receive buffer length
+ * @return types_error_code_e ERR_CODE_NOT_ALLOWED when the next read must go through msg_parser_run 
+ * from a caller buffer
+ */
+types_error_code_e msg_parser_get_rx_buffer(msg_parser_session_t * p_session, uint8_t ** pp_buffer, uint16_t * p_len)
+{
+    types_error_code_e err = ERR_CODE_NOT_ALLOWED;
+    uint32_t remaining = p_session->stream_size - p_session->firmware_bytes_read;
+
+    /* Compressed, delta and block streams are transformed before reaching the writer */
+    if ((p_session->state == WRITE_FIRMWARE) &&
+        ((p_session->flags & (EXT_FLAG_COMPRESSED | EXT_FLAG_DELTA | EXT_FLAG_BLOCKS)) == 0) &&
+        (remaining > 0))
+    {
+        size_t len = 0;
+
+        err = ota_writer_get_fill_buffer(pp_buffer, &len);
+        *p_len = (uint16_t)MIN(len, remaining);
+    }
+
+    return err;
 }
 
 /**
@@ -184,6 +491,57 @@ types_error_code_e msg_parser_build_firmware_ack(uint8_t * p_buffer, const uint8
     return ERR_CODE_OK;
 }
 
+/**
+ * @brief Build the acknowledges owed for the last msg_parser_run call. Legacy clients get a firmware ack
+ * for the header and every firmware read, extended clients get an OTA begin ack after the header and a 
+ * cumulative data ack each time half of the negotiated window has been consumed, plus a blocks ack once the 
+ * block hash list was received. When a read carried a header and firmware data, the acks are concatenated
+ * 
+ * @param p_session [in]: Parser session
+ * @param p_buffer [in]: Message data buffer
+ * @param len [in]: Message data buffer length
+ * @param p_out_len [out]: Built frames length, 0 when no ack is due
+ * @return types_error_code_e 
+ */
+types_error_code_e msg_parser_build_rx_ack(msg_parser_session_t * p_session, 
+                                           uint8_t * p_buffer, 
+                                           const uint8_t len, 
+                                           uint8_t * p_out_len)
+{
+    static const uint8_t ext_ack_types[][2] = {
+        {PENDING_ACK_BEGIN, EXT_ACK_TYPE_BEGIN},
+        {PENDING_ACK_BLOCKS, EXT_ACK_TYPE_BLOCKS},
+        {PENDING_ACK_DATA, EXT_ACK_TYPE_DATA},
+        {PENDING_ACK_STATUS, EXT_ACK_TYPE_STATUS}
+    };
+
+    types_error_code_e err = ERR_CODE_OK;
+    uint8_t pending_acks = p_session->pending_acks;
+    uint8_t offset = 0;
+    uint8_t frame_len = 0;
+
+    if ((pending_acks & PENDING_ACK_FIRMWARE) != 0)
+    {
+        err = msg_parser_build_firmware_ack(p_buffer, len, &frame_len);
+        offset += frame_len;
+    }
+
+    for (uint8_t i = 0; (i < (sizeof(ext_ack_types) / sizeof(ext_ack_types[0]))) && (err == ERR_CODE_OK); i++)
+    {
+        if ((pending_acks & ext_ack_types[i][0]) != 0)
+        {
+            err = build_ext_ack(p_session, ext_ack_types[i][1], p_buffer + offset, len - offset, &frame_len);
+            offset += frame_len;
+        }
+    }
+
+    *p_out_len = (err == ERR_CODE_OK) ? offset : 0;
+
+    p_session->pending_acks = PENDING_ACK_NONE;
+
+    return err;
+}
+
 /**
  * @brief 
  * 
@@ -223,6 +581,170 @@ types_error_code_e msg_parser_build_ota_ack(uint8_t * p_buffer,
     return ERR_CODE_OK;
 }
 
+/**
+ * @brief Accumulate header bytes until a whole frame was received and parse it. Reads may carry a partial
+ * header, or several frames like a status query followed by an OTA begin
+ * 
+ * @param p_session [in]: Parser session
+ * @param p_data [in]: Message data buffer
+ * @param len [in]: Message data buffer length
+ * @param p_out_consumed [out]: Bytes consumed, the rest of the read belongs to the firmware
+ * @return types_error_code_e ERR_CODE_NOT_ALLOWED when a legacy header was refused
+ */
+static types_error_code_e read_header(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len, uint16_t * p_out_consumed)
+{
+    types_error_code_e err = ERR_CODE_OK;
+    uint16_t consumed = 0;
+
+    while ((consumed < len) && (p_session->state == READ_HEADER))
+    {
+        uint16_t target_len = get_header_target_len(p_session);
+
+        if (target_len > EXT_HEADER_MAX_SIZE_IN_BYTES)
+        {
+            /* Not a frame this version knows, there is no way to find where it ends */
+            p_session->begin_status = BEGIN_ACK_REJECTED;
+            p_session->pending_acks |= PENDING_ACK_BEGIN;
+            p_session->header_len = 0;
+            p_session->state = DISCARD_STREAM;
+            consumed = len;
+            break;
+        }
+
+        uint16_t chunk_len = MIN(target_len - p_session->header_len, len - consumed);
+
+        memcpy(p_session->header + p_session->header_len, p_data + consumed, chunk_len);
+        p_session->header_len += chunk_len;
+        consumed += chunk_len;
+
+        if (p_session->header_len == get_header_target_len(p_session))
+        {
+            err = parse_header_frame(p_session);
+            p_session->header_len = 0;
+        }
+    }
+
+    *p_out_consumed = consumed;
+
+    return err;
+}
+
+/**
+ * @brief Number of header bytes needed to make progress: the magic first, then the extended prefix with
+ * the payload length, then the whole frame
+ * 
+ * @param p_session [in]: Parser session
+ * @return uint16_t 
+ */
+static uint16_t get_header_target_len(state_machine_params_t * p_session)
+{
+    const uint8_t *p_header = p_session->header;
+    uint16_t header_len = p_session->header_len;
+
+    if (header_len < FIRMWARE_LEN_SIZE_IN_BYTES)
+    {
+        return FIRMWARE_LEN_SIZE_IN_BYTES;
+    }
+
+    if (get_u32_le(p_header) != EXT_HEADER_MAGIC)
+    {
+        return HEADER_SIZE_IN_BYTES;
+    }
+
+    if (header_len < EXT_HEADER_PREFIX_SIZE_IN_BYTES)
+    {
+        return EXT_HEADER_PREFIX_SIZE_IN_BYTES;
+    }
+
+    return EXT_HEADER_PREFIX_SIZE_IN_BYTES + (uint16_t)(p_header[6] | (p_header[7] << 8U));
+}
+
+/**
+ * @brief Handle a complete header frame and owe its ack. Status queries are answered by any session,
+ * updates only by the session holding the OTA lock
+ * 
+ * @param p_session [in]: Parser session
+ * @return types_error_code_e ERR_CODE_NOT_ALLOWED when a legacy header arrives while updates must be signed
+ * or while another session is updating
+ */
+static types_error_code_e parse_header_frame(state_machine_params_t * p_session)
+{
+    const uint8_t *p_header = p_session->header;
+    uint16_t header_len = p_session->header_len;
+    int64_t start_us = ota_metrics_start();
+
+    if ((get_u32_le(p_header) != EXT_HEADER_MAGIC) && ota_manifest_is_required())
+    {
+        /* Legacy headers have no room for a manifest */
+        p_session->state = DISCARD_STREAM;
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if (!is_status_query(p_header, header_len) && !take_ota_lock(p_session))
+    {
+        p_session->state = DISCARD_STREAM;
+
+        if (get_u32_le(p_header) != EXT_HEADER_MAGIC)
+        {
+            return ERR_CODE_NOT_ALLOWED;
+        }
+
+        p_session->begin_status = BEGIN_ACK_BUSY;
+        p_session->pending_acks |= PENDING_ACK_BEGIN;
+        return ERR_CODE_OK;
+    }
+
+    if (get_u32_le(p_header) != EXT_HEADER_MAGIC)
+    {
+        parse_header(p_header, &p_session->firmware_size, p_session->hash);
+        p_session->stream_size = p_session->firmware_size;
+        p_session->pending_acks |= PENDING_ACK_FIRMWARE;
+
+        p_session->state = START_OTA;
+    }
+    else if (is_status_query(p_header, header_len))
+    {
+        p_session->pending_acks |= PENDING_ACK_STATUS;
+    }
+    else
+    {
+        p_session->pending_acks |= PENDING_ACK_BEGIN;
+
+        if (parse_ext_header(p_session, p_header, header_len) != ERR_CODE_OK)
+        {
+            p_session->state = DISCARD_STREAM;
+            release_ota_lock(p_session);
+        }
+        else if (((p_session->flags & EXT_FLAG_PRESENT) != 0) && use_present_image(p_session))
+        {
+            release_ota_lock(p_session);
+
+            /* A switched boot partition is applied by the restart following the OTA ack, otherwise the
+             * session is free for another header */
+            if (p_session->is_boot_switched)
+            {
+                p_session->state = DISCARD_STREAM;
+            }
+            else
+            {
+                reset_params(p_session);
+            }
+        }
+        else
+        {
+            p_session->state = START_OTA;
+        }
+    }
+
+    if (p_session->state == START_OTA)
+    {
+        ota_metrics_begin_update(p_session->firmware_size);
+        ota_metrics_stop(OTA_METRICS_PHASE_HEADER, start_us);
+    }
+
+    return ERR_CODE_OK;
+}
+
 /**
  * @brief Parse header message
  * 
@@ -239,3 +761,582 @@ static void parse_header(const uint8_t * p_data, uint32_t * p_firmware_size, uin
 
     memcpy(p_hash, p_data + FIRMWARE_LEN_SIZE_IN_BYTES, HASH_SIZE_IN_BYTES);
 }
+
+
+/**
+ * @brief Parse an extended header and negotiate the transfer mode
+ * 
+ * @param p_session [in]: Parser session
+ * @param p_data [in]: Message data buffer
+ * @param len [in]: Message data buffer length
+ * @return types_error_code_e 
+ */
+static types_error_code_e parse_ext_header(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len)
+{
+    uint16_t payload_len = (uint16_t)(p_data[6] | (p_data[7] << 8U));
+    const uint8_t *p_payload = p_data + EXT_HEADER_PREFIX_SIZE_IN_BYTES;
+
+    p_session->begin_status = BEGIN_ACK_REJECTED;
+    p_session->window_size = 0;
+    p_session->resume_offset = 0;
+
+    if ((p_data[4] != EXT_HEADER_VERSION) || 
+        (p_data[5] != EXT_HEADER_TYPE_OTA_BEGIN) ||
+        (len != (EXT_HEADER_PREFIX_SIZE_IN_BYTES + payload_len)) ||
+        (payload_len < OTA_BEGIN_MIN_SIZE_IN_BYTES))
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    uint16_t flags = (uint16_t)(p_payload[0] | (p_payload[1] << 8U));
+    uint16_t offset = 2U;
+
+    uint32_t firmware_size = 0;
+    parse_header(p_payload + offset, &firmware_size, p_session->hash);
+    offset += HEADER_SIZE_IN_BYTES;
+
+    uint32_t window_size = 0;
+    if ((flags & EXT_FLAG_WINDOWED) != 0)
+    {
+        if (payload_len < (offset + WINDOW_SIZE_IN_BYTES))
+        {
+            return ERR_CODE_INVALID_PARAM;
+        }
+
+        window_size = get_u32_le(p_payload + offset);
+        offset += WINDOW_SIZE_IN_BYTES;
+
+        if ((window_size == 0) || (window_size > MSG_PARSER_MAX_WINDOW_BYTES))
+        {
+            window_size = MSG_PARSER_MAX_WINDOW_BYTES;
+        }
+    }
+
+    /* Compressed images and patches are not firmware_size bytes long on the wire */
+    uint32_t stream_size = firmware_size;
+    if ((flags & (EXT_FLAG_COMPRESSED | EXT_FLAG_DELTA)) != 0)
+    {
+        if (payload_len < (offset + STREAM_SIZE_IN_BYTES))
+        {
+            return ERR_CODE_INVALID_PARAM;
+        }
+
+        stream_size = get_u32_le(p_payload + offset);
+        offset += STREAM_SIZE_IN_BYTES;
+    }
+
+    /* Block streams carry the hash list, then at most the whole image until the plan tells how much */
+    if ((flags & EXT_FLAG_BLOCKS) != 0)
+    {
+        if (((flags & (EXT_FLAG_COMPRESSED | EXT_FLAG_DELTA)) != 0) || (firmware_size == 0) ||
+            (firmware_size > (OTA_BLOCKS_MAX_COUNT * OTA_BLOCKS_BLOCK_LEN_BYTES)))
+        {
+            return ERR_CODE_INVALID_PARAM;
+        }
+
+        stream_size = (OTA_BLOCKS_COUNT(firmware_size) * OTA_BLOCKS_HASH_LEN) + firmware_size;
+    }
+
+    if ((flags & EXT_FLAG_STREAM_HASH) != 0)
+    {
+        if (((flags & EXT_FLAG_COMPRESSED) == 0) || (payload_len < (offset + HASH_SIZE_IN_BYTES)))
+        {
+            return ERR_CODE_INVALID_PARAM;
+        }
+
+        memcpy(p_session->stream_hash, p_payload + offset, HASH_SIZE_IN_BYTES);
+        offset += HASH_SIZE_IN_BYTES;
+    }
+
+    /* Checked before anything is erased, the streamed hash then binds the received image to the manifest */
+    const uint8_t *p_manifest = ((flags & EXT_FLAG_MANIFEST) != 0) ? (p_payload + offset) : NULL;
+    if (check_manifest(p_session, p_manifest, payload_len - offset, firmware_size) != ERR_CODE_OK)
+    {
+        p_session->begin_status = BEGIN_ACK_BAD_MANIFEST;
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    /* Only the image offset is checkpointed, compressed, delta and block streams always restart from scratch */
+    size_t resume_offset = 0;
+    if (((flags & EXT_FLAG_RESUME) != 0) && ((flags & (EXT_FLAG_COMPRESSED | EXT_FLAG_DELTA | EXT_FLAG_BLOCKS)) == 0))
+    {
+        ota_process_get_resume_offset(firmware_size, p_session->hash, &resume_offset);
+    }
+
+    p_session->is_extended = true;
+    p_session->flags = flags;
+    p_session->firmware_size = firmware_size;
+    p_session->stream_size = stream_size;
+    p_session->window_size = window_size;
+    p_session->resume_offset = resume_offset;
+    p_session->firmware_bytes_read = resume_offset;
+    p_session->acked_bytes = resume_offset;
+    p_session->begin_status = BEGIN_ACK_ACCEPTED;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Check the manifest of an OTA begin against the announced image. Without a provisioned public
+ * key manifests are optional and ignored
+ * 
+ * @param p_session [in]: Parser session
+ * @param p_data [in]: Manifest buffer, NULL when the header has none
+ * @param len [in]: Manifest buffer length
+ * @param firmware_size [in]: Firmware size announced by the header
+ * @return types_error_code_e 
+ */
+static types_error_code_e check_manifest(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len, const uint32_t firmware_size)
+{
+    if (!ota_manifest_is_required())
+    {
+        return ERR_CODE_OK;
+    }
+
+    if (p_data == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    uint32_t signed_size = 0;
+    uint8_t signed_hash[OTA_MANIFEST_HASH_LEN] = {};
+
+    types_error_code_e err = ota_manifest_verify(p_data, len, &signed_size, signed_hash);
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
+
+    if ((signed_size != firmware_size) || (memcmp(signed_hash, p_session->hash, HASH_SIZE_IN_BYTES) != 0))
+    {
+        return ERR_CODE_FAIL;
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Look for the announced image in the partitions, so it is not transferred again
+ * 
+ * @param p_session [in]: Parser session
+ * @return true when a partition holds the image, the begin ack then tells whether the boot partition was switched
+ */
+static bool use_present_image(state_machine_params_t * p_session)
+{
+    bool is_switched = false;
+
+    if (ota_process_use_present(p_session->firmware_size, p_session->hash, &is_switched) != ERR_CODE_OK)
+    {
+        return false;
+    }
+
+    p_session->begin_status = is_switched ? BEGIN_ACK_BOOT_SWITCHED : BEGIN_ACK_PRESENT;
+    p_session->is_boot_switched = is_switched;
+    p_session->resume_offset = 0;
+
+    return true;
+}
+
+/**
+ * @brief Check whether the message is a status query, which is answered without starting an update
+ * 
+ * @param p_data [in]: Message data buffer
+ * @param len [in]: Message data buffer length
+ * @return true for a well formed status query
+ */
+static bool is_status_query(const uint8_t * p_data, const uint16_t len)
+{
+    return ((len == EXT_HEADER_PREFIX_SIZE_IN_BYTES) &&
+            (get_u32_le(p_data) == EXT_HEADER_MAGIC) &&
+            (p_data[4] == EXT_HEADER_VERSION) &&
+            (p_data[5] == EXT_HEADER_TYPE_STATUS_QUERY) &&
+            (p_data[6] == 0U) &&
+            (p_data[7] == 0U));
+}
+
+/**
+ * @brief Start or resume the update announced by the header and arm the stream stages. An update 
+ * left in progress is released before retrying
+ * 
+ * @param p_session [in]: Parser session
+ * @return types_error_code_e 
+ */
+static types_error_code_e start_update(state_machine_params_t * p_session)
+{
+    uint32_t size = p_session->firmware_size;
+    uint32_t offset = p_session->resume_offset;
+
+    types_error_code_e err = (offset > 0) ? ota_process_resume(size, p_session->hash, offset) :
+                                            ota_process_init(size, p_session->hash);
+
+    if (err == ERR_CODE_NOT_ALLOWED)
+    {
+        ota_process_end(false);
+
+        err = (offset > 0) ? ota_process_resume(size, p_session->hash, offset) :
+                             ota_process_init(size, p_session->hash);
+    }
+
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
+
+    /* Stages are chained as decompressor -> delta -> writer, skipping the ones not negotiated. Block streams
+     * only go through ota_blocks */
+    uint16_t flags = p_session->flags;
+
+    ota_writer_start();
+
+    if ((flags & EXT_FLAG_DELTA) != 0)
+    {
+        err = ota_delta_start(ota_writer_push);
+    }
+
+    if ((flags & EXT_FLAG_BLOCKS) != 0)
+    {
+        err = ota_blocks_start(size, ota_writer_push);
+    }
+
+    if ((err == ERR_CODE_OK) && ((flags & EXT_FLAG_COMPRESSED) != 0))
+    {
+        const uint8_t *p_stream_hash = ((flags & EXT_FLAG_STREAM_HASH) != 0) ? p_session->stream_hash : NULL;
+
+        err = ota_decompressor_start(((flags & EXT_FLAG_DELTA) != 0) ? ota_delta_feed : ota_writer_push, p_stream_hash);
+    }
+
+    if (err != ERR_CODE_OK)
+    {
+        abort_stream();
+        ota_process_end(false);
+    }
+
+    return err;
+}
+
+/**
+ * @brief Hand received firmware data to the first stream stage. Flash writes run on the ota_writer task,
+ * so the receive path is only blocked when its ring is full
+ * 
+ * @param p_session [in]: Parser session
+ * @param p_data [in]: Message data buffer
+ * @param len [in]: Message data buffer length
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the stream is healthy
+ */
+static types_error_code_e push_stream(state_machine_params_t * p_session, const uint8_t * p_data, const uint16_t len)
+{
+    if ((p_session->flags & EXT_FLAG_COMPRESSED) != 0)
+    {
+        return ota_decompressor_feed(p_data, len);
+    }
+
+    if ((p_session->flags & EXT_FLAG_DELTA) != 0)
+    {
+        return ota_delta_feed(p_data, len);
+    }
+
+    if ((p_session->flags & EXT_FLAG_BLOCKS) != 0)
+    {
+        return ota_blocks_feed(p_data, len);
+    }
+
+    return ota_writer_push(p_data, len);
+}
+
+/**
+ * @brief Drain every stream stage once the whole stream was received
+ * 
+ * @param p_session [in]: Parser session
+ * @return types_error_code_e ERR_CODE_OK when the image was written and verified
+ */
+static types_error_code_e finish_stream(state_machine_params_t * p_session)
+{
+    uint16_t flags = p_session->flags;
+
+    if (((flags & EXT_FLAG_COMPRESSED) != 0) && (ota_decompressor_finish() != ERR_CODE_OK))
+    {
+        abort_stream();
+        return ERR_CODE_FAIL;
+    }
+
+    if (((flags & EXT_FLAG_DELTA) != 0) && (ota_delta_finish() != ERR_CODE_OK))
+    {
+        abort_stream();
+        return ERR_CODE_FAIL;
+    }
+
+    if (((flags & EXT_FLAG_BLOCKS) != 0) && (ota_blocks_finish() != ERR_CODE_OK))
+    {
+        abort_stream();
+        return ERR_CODE_FAIL;
+    }
+
+    return ota_writer_finish();
+}
+
+/**
+ * @brief Release every stream stage
+ * 
+ */
+static void abort_stream(void)
+{
+    ota_decompressor_abort();
+    ota_delta_abort();
+    ota_blocks_abort();
+    ota_writer_abort();
+}
+
+/**
+ * @brief Close the transfer of the session holding the OTA lock, once the stream stages are drained or aborted
+ * 
+ * @param p_session [in]: Parser session
+ * @param result [in]: ERR_CODE_OK when the image was written and verified
+ * @param p_out_bytes_read [out]: Firmware bytes read, for the OTA ack
+ * @return types_error_code_e ERR_CODE_OK when the new image will boot
+ */
+static types_error_code_e end_transfer(state_machine_params_t * p_session, const types_error_code_e result, uint32_t * p_out_bytes_read)
+{
+    /* Externalize firmware bytes read */
+    *p_out_bytes_read = p_session->firmware_bytes_read;
+
+    /* The OTA ack closes the transfer in both modes */
+    p_session->pending_acks &= (uint8_t)~PENDING_ACK_DATA;
+
+    /* A transfer that failed before its last byte, or ran past it, leaves firmware on its way that
+     * must not be parsed as a header */
+    bool is_stream_left = (p_session->firmware_bytes_read != p_session->stream_size);
+
+    /* Clean parameters */
+    reset_params(p_session);
+
+    types_error_code_e err = ota_process_end(result == ERR_CODE_OK);
+    ota_metrics_end_update(err == ERR_CODE_OK);
+
+    sys_feedback_set_normal_mode();
+    release_ota_lock(p_session);
+
+    p_session->state = is_stream_left ? DISCARD_STREAM : READ_HEADER;
+
+    return err;
+}
+
+/**
+ * @brief Once the block hash list was received, owe the blocks ack and shrink the stream to the hash list
+ * and the requested blocks
+ * 
+ * @param p_session [in]: Parser session
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the stream is healthy
+ */
+static types_error_code_e check_block_plan(state_machine_params_t * p_session)
+{
+    if (p_session->is_block_plan_ready)
+    {
+        return ERR_CODE_IN_PROGRESS;
+    }
+
+    types_error_code_e err = ota_blocks_get_plan(p_session->block_bitmap, sizeof(p_session->block_bitmap),
+                                                 &p_session->block_needed_len);
+    if (err == ERR_CODE_NOT_ALLOWED)
+    {
+        return ERR_CODE_IN_PROGRESS;
+    }
+
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
+
+    p_session->is_block_plan_ready = true;
+    p_session->block_bitmap_len = (uint8_t)((OTA_BLOCKS_COUNT(p_session->firmware_size) + 7U) / 8U);
+    p_session->stream_size = (OTA_BLOCKS_COUNT(p_session->firmware_size) * OTA_BLOCKS_HASH_LEN) +
+                             p_session->block_needed_len;
+    p_session->pending_acks |= PENDING_ACK_BLOCKS;
+
+    return ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Decide which ack is owed for the firmware bytes consumed so far. Without a window every read
+ * is acknowledged, with a window the cumulative offset is acknowledged each half window
+ * 
+ * @param p_session [in]: Parser session
+ */
+static void update_data_ack(state_machine_params_t * p_session)
+{
+    if (!p_session->is_extended)
+    {
+        return;
+    }
+
+    uint32_t unacked = p_session->firmware_bytes_read - p_session->acked_bytes;
+
+    if ((unacked > 0) && (unacked >= (p_session->window_size / 2U)))
+    {
+        p_session->acked_bytes = p_session->firmware_bytes_read;
+        p_session->pending_acks |= PENDING_ACK_DATA;
+    }
+}
+
+/**
+ * @brief Build an extended ack frame
+ * 
+ * @param p_session [in]: Parser session
+ * @param type [in]: Ack type
+ * @param p_buffer [out]: Frame buffer
+ * @param len [in]: Frame buffer length
+ * @param p_out_len [out]: Built frame length
+ * @return types_error_code_e 
+ */
+static types_error_code_e build_ext_ack(state_machine_params_t * p_session, const uint8_t type, uint8_t * p_buffer, const uint8_t len, uint8_t * p_out_len)
+{
+    uint16_t payload_len = DATA_ACK_PAYLOAD_SIZE_IN_BYTES;
+
+    if (type == EXT_ACK_TYPE_BEGIN)
+    {
+        payload_len = BEGIN_ACK_PAYLOAD_SIZE_IN_BYTES;
+    }
+    else if (type == EXT_ACK_TYPE_STATUS)
+    {
+        payload_len = OTA_METRICS_SUMMARY_LEN_BYTES;
+    }
+    else if (type == EXT_ACK_TYPE_BLOCKS)
+    {
+        payload_len = BLOCKS_ACK_NEEDED_SIZE_IN_BYTES + p_session->block_bitmap_len;
+    }
+
+    *p_out_len = 0;
+
+    if (len < (EXT_ACK_PREFIX_SIZE_IN_BYTES + payload_len))
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    uint8_t *p_payload = p_buffer + EXT_ACK_PREFIX_SIZE_IN_BYTES;
+    types_error_code_e err = ERR_CODE_OK;
+    uint8_t summary_len = 0;
+
+    p_buffer[0] = EXT_ACK_MARKER;
+    p_buffer[1] = type;
+    p_buffer[2] = payload_len & 0xFF;
+    p_buffer[3] = (payload_len >> 8U) & 0xFF;
+
+    if (type == EXT_ACK_TYPE_BEGIN)
+    {
+        p_payload[0] = p_session->begin_status;
+        put_u32_le(p_payload + 1U, p_session->window_size);
+        put_u32_le(p_payload + 1U + WINDOW_SIZE_IN_BYTES, p_session->resume_offset);
+    }
+    else if (type == EXT_ACK_TYPE_STATUS)
+    {
+        err = ota_metrics_build_summary(p_payload, (uint8_t)payload_len, &summary_len);
+    }
+    else if (type == EXT_ACK_TYPE_BLOCKS)
+    {
+        put_u32_le(p_payload, p_session->block_needed_len);
+        memcpy(p_payload + BLOCKS_ACK_NEEDED_SIZE_IN_BYTES, p_session->block_bitmap, p_session->block_bitmap_len);
+    }
+    else
+    {
+        put_u32_le(p_payload, p_session->acked_bytes);
+    }
+
+    if (err == ERR_CODE_OK)
+    {
+        *p_out_len = EXT_ACK_PREFIX_SIZE_IN_BYTES + payload_len;
+    }
+
+    return err;
+}
+
+/**
+ * @brief Reset the transfer parameters
+ * 
+ * @param p_session [in]: Parser session
+ */
+static void reset_params(state_machine_params_t * p_session)
+{
+    p_session->firmware_size = 0;
+    p_session->firmware_bytes_read = 0;
+    memset(p_session->hash, 0, sizeof(p_session->hash));
+    p_session->stream_size = 0;
+    memset(p_session->stream_hash, 0, sizeof(p_session->stream_hash));
+    p_session->is_extended = false;
+    p_session->flags = 0;
+    p_session->window_size = 0;
+    p_session->acked_bytes = 0;
+    p_session->resume_offset = 0;
+    p_session->is_boot_switched = false;
+    p_session->is_block_plan_ready = false;
+    p_session->header_len = 0;
+}
+
+/**
+ * @brief Take the OTA lock, a session already holding it keeps it
+ * 
+ * @param p_session [in]: Parser session
+ * @return true when the session holds the lock
+ */
+static bool take_ota_lock(state_machine_params_t * p_session)
+{
+    xSemaphoreTake(parser_instance.semaphore, portMAX_DELAY);
+
+    if (parser_instance.p_ota_owner == NULL)
+    {
+        parser_instance.p_ota_owner = p_session;
+    }
+
+    bool is_owner = (parser_instance.p_ota_owner == p_session);
+
+    xSemaphoreGive(parser_instance.semaphore);
+
+    return is_owner;
+}
+
+/**
+ * @brief Release the OTA lock if the session holds it
+ * 
+ * @param p_session [in]: Parser session
+ */
+static void release_ota_lock(state_machine_params_t * p_session)
+{
+    xSemaphoreTake(parser_instance.semaphore, portMAX_DELAY);
+
+    if (parser_instance.p_ota_owner == p_session)
+    {
+        parser_instance.p_ota_owner = NULL;
+    }
+
+    xSemaphoreGive(parser_instance.semaphore);
+}
+
+/**
+ * @brief Read a little endian 32 bits value
+ * 
+ * @param p_data [in]: Data buffer
+ * @return uint32_t 
+ */
+static uint32_t get_u32_le(const uint8_t * p_data)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        value |= ((uint32_t)p_data[i]) << (8U * i);
+    }
+
+    return value;
+}
+
+/**
+ * @brief Write a little endian 32 bits value
+ * 
+ * @param p_data [out]: Data buffer
+ * @param value [in]: Value to be written
+ */
+static void put_u32_le(uint8_t * p_data, const uint32_t value)
+{
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        p_data[i] = (value >> (8U * i)) & 0xFF;
+    }
+}
\ No newline at end of file
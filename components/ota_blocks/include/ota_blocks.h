@@ -0,0 +1,36 @@
+#ifndef OTA_BLOCKS_H
+#define OTA_BLOCKS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+#define OTA_BLOCKS_BLOCK_LEN_BYTES      (4096U)     /* One flash sector */
+#define OTA_BLOCKS_HASH_LEN             (8U)        /* Leading bytes of the SHA-256 of a block */
+#define OTA_BLOCKS_MAX_COUNT            (512U)      /* Images up to 2 MB, the bitmap fits in the parser acks */
+#define OTA_BLOCKS_BITMAP_MAX_LEN       (OTA_BLOCKS_MAX_COUNT / 8U)
+
+#define OTA_BLOCKS_COUNT(size)          (((size) + OTA_BLOCKS_BLOCK_LEN_BYTES - 1U) / OTA_BLOCKS_BLOCK_LEN_BYTES)
+
+
+/**
+ * @brief Destination of the assembled image
+ *
+ * Must return ERR_CODE_IN_PROGRESS while the data is accepted
+ */
+typedef types_error_code_e (*ota_blocks_sink_t)(const uint8_t * p_data, const size_t len);
+
+
+types_error_code_e ota_blocks_start(const uint32_t image_size, ota_blocks_sink_t sink);
+
+types_error_code_e ota_blocks_feed(const uint8_t * p_data, const size_t len);
+
+types_error_code_e ota_blocks_get_plan(uint8_t * p_bitmap, const size_t len, uint32_t * p_out_needed_len);
+
+types_error_code_e ota_blocks_finish(void);
+
+void ota_blocks_abort(void);
+
+#endif
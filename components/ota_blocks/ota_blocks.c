@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_image_format.h"
+#include "mbedtls/sha256.h"
+#include "ota_manager.h"
+#include "ota_blocks.h"
+
+
+/* ------------------- STREAM FORMAT -------------------
+ * The stream starts with the hash list: the first OTA_BLOCKS_HASH_LEN bytes of the SHA-256 of every
+ * OTA_BLOCKS_BLOCK_LEN_BYTES block of the image, in order, the last block being possibly shorter.
+ * Once it is complete the plan tells which blocks the client must send, the stream then carries
+ * those blocks only, in order. The other ones are copied from flash:
+ * - from any offset of the running image, for whole blocks;
+ * - from the same offset of the update partition, only with OTA_SKIP_UNCHANGED, where nothing is
+ *   erased before being compared. The sector is then left as it is by ota_manager.
+ * A truncated hash may match a different block, the image hash checked by ota_manager catches it.
+ */
+#define HASH_SIZE_IN_BYTES          (32U)
+#define SOURCE_NEEDED               (UINT32_MAX)            /* Sent by the client */
+#define SOURCE_IN_PLACE             (UINT32_MAX - 1U)       /* Already at its offset in the update partition */
+
+
+typedef enum {
+    BLOCKS_READ_HASHES,
+    BLOCKS_DATA
+} ota_blocks_states_e;
+
+typedef struct {
+    uint8_t hash[OTA_BLOCKS_HASH_LEN];
+    uint32_t offset;
+} block_index_entry_t;
+
+typedef struct {
+    ota_blocks_states_e state;
+    const esp_partition_t *running;
+    const esp_partition_t *update;
+    uint32_t image_size;
+    uint32_t count;
+    uint8_t *p_hashes;          /* Hash list, released once the plan is built */
+    uint32_t hashes_len;
+    uint32_t *p_sources;        /* Running partition offset of each block, or one of the SOURCE_ values */
+    uint32_t needed_len;
+    uint32_t cursor;            /* Next block handed to the sink */
+    uint32_t block_left;        /* Bytes of the block being received still expected */
+    uint8_t block_buf[OTA_BLOCKS_BLOCK_LEN_BYTES];
+    ota_blocks_sink_t sink;
+} ota_blocks_ctx_t;
+
+
+static const char *tag = "OTA_BLOCKS";
+
+static ota_blocks_ctx_t *p_ctx = NULL;
+
+
+static void build_plan(void);
+static block_index_entry_t *build_running_index(uint32_t * p_out_count);
+static bool is_in_place(const uint32_t block, const uint8_t * p_hash);
+static types_error_code_e hash_block(const esp_partition_t * p_partition, const uint32_t offset, const uint32_t len, uint8_t * p_out_hash);
+static types_error_code_e copy_local_blocks(void);
+static uint32_t get_block_len(const uint32_t block);
+static int compare_entries(const void * p_a, const void * p_b);
+
+/**
+ * @brief Start receiving an image as a hash list followed by the blocks missing from flash
+ *
+ * @param image_size [in]: Image size announced by the header
+ * @param sink [in]: Destination of the assembled image
+ * @return types_error_code_e
+ */
+types_error_code_e ota_blocks_start(const uint32_t image_size, ota_blocks_sink_t sink)
+{
+    if (p_ctx != NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if ((sink == NULL) || (image_size == 0) || (image_size > (OTA_BLOCKS_MAX_COUNT * OTA_BLOCKS_BLOCK_LEN_BYTES)))
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_t *update = esp_ota_get_next_update_partition(NULL);
+    if ((running == NULL) || (update == NULL))
+    {
+        ESP_LOGE(tag, "----- App partitions not found -----");
+        return ERR_CODE_FAIL;
+    }
+
+    p_ctx = calloc(1, sizeof(ota_blocks_ctx_t));
+    if (p_ctx != NULL)
+    {
+        p_ctx->count = OTA_BLOCKS_COUNT(image_size);
+        p_ctx->p_hashes = malloc(p_ctx->count * OTA_BLOCKS_HASH_LEN);
+        p_ctx->p_sources = malloc(p_ctx->count * sizeof(uint32_t));
+    }
+
+    if ((p_ctx == NULL) || (p_ctx->p_hashes == NULL) || (p_ctx->p_sources == NULL))
+    {
+        ESP_LOGE(tag, "----- Not enough memory for the block list -----");
+        ota_blocks_abort();
+        return ERR_CODE_FAIL;
+    }
+
+    p_ctx->state = BLOCKS_READ_HASHES;
+    p_ctx->running = running;
+    p_ctx->update = update;
+    p_ctx->image_size = image_size;
+    p_ctx->sink = sink;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Take a piece of the stream: the hash list first, then the requested blocks, which are handed
+ * to the sink in image order along with the blocks copied from flash
+ *
+ * @param p_data [in]: Stream data buffer
+ * @param len [in]: Stream data buffer length
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the stream is healthy, ERR_CODE_FAIL otherwise
+ */
+types_error_code_e ota_blocks_feed(const uint8_t * p_data, const size_t len)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    size_t offset = 0;
+
+    if (p_ctx->state == BLOCKS_READ_HASHES)
+    {
+        offset = MIN(len, (size_t)((p_ctx->count * OTA_BLOCKS_HASH_LEN) - p_ctx->hashes_len));
+        memcpy(p_ctx->p_hashes + p_ctx->hashes_len, p_data, offset);
+        p_ctx->hashes_len += offset;
+
+        if (p_ctx->hashes_len == (p_ctx->count * OTA_BLOCKS_HASH_LEN))
+        {
+            build_plan();
+        }
+    }
+
+    while (offset < len)
+    {
+        /* Blocks available locally are copied lazily, right before the next requested one */
+        if (p_ctx->block_left == 0)
+        {
+            if (copy_local_blocks() != ERR_CODE_OK)
+            {
+                return ERR_CODE_FAIL;
+            }
+
+            if (p_ctx->cursor == p_ctx->count)
+            {
+                ESP_LOGE(tag, "----- More data than the requested blocks -----");
+                return ERR_CODE_FAIL;
+            }
+
+            p_ctx->block_left = get_block_len(p_ctx->cursor);
+        }
+
+        size_t chunk_len = MIN(len - offset, (size_t)p_ctx->block_left);
+
+        if (p_ctx->sink(p_data + offset, chunk_len) != ERR_CODE_IN_PROGRESS)
+        {
+            return ERR_CODE_FAIL;
+        }
+
+        offset += chunk_len;
+        p_ctx->block_left -= chunk_len;
+
+        if (p_ctx->block_left == 0)
+        {
+            p_ctx->cursor++;
+        }
+    }
+
+    return ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Get the blocks the client must send, available once the whole hash list was received
+ *
+ * @param p_bitmap [out]: One bit per block, least significant bit first, set for the requested ones
+ * @param len [in]: Bitmap buffer length
+ * @param p_out_needed_len [out]: Bytes of the stream following the hash list
+ * @return types_error_code_e ERR_CODE_NOT_ALLOWED while the hash list is incomplete
+ */
+types_error_code_e ota_blocks_get_plan(uint8_t * p_bitmap, const size_t len, uint32_t * p_out_needed_len)
+{
+    if ((p_ctx == NULL) || (p_ctx->state != BLOCKS_DATA))
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if (len < ((p_ctx->count + 7U) / 8U))
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    memset(p_bitmap, 0, (p_ctx->count + 7U) / 8U);
+
+    for (uint32_t i = 0; i < p_ctx->count; i++)
+    {
+        if (p_ctx->p_sources[i] == SOURCE_NEEDED)
+        {
+            p_bitmap[i / 8U] |= (uint8_t)(1U << (i % 8U));
+        }
+    }
+
+    *p_out_needed_len = p_ctx->needed_len;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Copy the blocks following the last requested one, check every block was handed to the sink,
+ * then release the session
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_blocks_finish(void)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    types_error_code_e err = ERR_CODE_OK;
+
+    if ((p_ctx->state != BLOCKS_DATA) || (p_ctx->block_left != 0))
+    {
+        ESP_LOGE(tag, "----- Truncated block stream -----");
+        err = ERR_CODE_FAIL;
+    }
+    else if ((copy_local_blocks() != ERR_CODE_OK) || (p_ctx->cursor != p_ctx->count))
+    {
+        ESP_LOGE(tag, "----- Image incomplete, %lu of %lu blocks -----", (unsigned long)p_ctx->cursor,
+                 (unsigned long)p_ctx->count);
+        err = ERR_CODE_FAIL;
+    }
+
+    ota_blocks_abort();
+
+    return err;
+}
+
+/**
+ * @brief Release the session
+ *
+ */
+void ota_blocks_abort(void)
+{
+    if (p_ctx == NULL)
+    {
+        return;
+    }
+
+    free(p_ctx->p_hashes);
+    free(p_ctx->p_sources);
+    free(p_ctx);
+    p_ctx = NULL;
+}
+
+/**
+ * @brief Find where each block of the hash list can be copied from, the others are requested
+ *
+ */
+static void build_plan(void)
+{
+    uint32_t index_count = 0;
+    block_index_entry_t *p_index = build_running_index(&index_count);
+    uint32_t in_place_count = 0;
+    uint32_t copied_count = 0;
+
+    for (uint32_t i = 0; i < p_ctx->count; i++)
+    {
+        const uint8_t *p_hash = p_ctx->p_hashes + (i * OTA_BLOCKS_HASH_LEN);
+        block_index_entry_t *p_entry = NULL;
+
+        p_ctx->p_sources[i] = SOURCE_NEEDED;
+
+        if (OTA_SKIP_UNCHANGED && is_in_place(i, p_hash))
+        {
+            p_ctx->p_sources[i] = SOURCE_IN_PLACE;
+            in_place_count++;
+            continue;
+        }
+
+        /* The running image is indexed by whole blocks only */
+        if ((p_index != NULL) && (get_block_len(i) == OTA_BLOCKS_BLOCK_LEN_BYTES))
+        {
+            block_index_entry_t key = {};
+            memcpy(key.hash, p_hash, OTA_BLOCKS_HASH_LEN);
+
+            p_entry = bsearch(&key, p_index, index_count, sizeof(block_index_entry_t), compare_entries);
+        }
+
+        if (p_entry != NULL)
+        {
+            p_ctx->p_sources[i] = p_entry->offset;
+            copied_count++;
+        }
+        else
+        {
+            p_ctx->needed_len += get_block_len(i);
+        }
+    }
+
+    free(p_index);
+    free(p_ctx->p_hashes);
+    p_ctx->p_hashes = NULL;
+
+    p_ctx->state = BLOCKS_DATA;
+
+    ESP_LOGI(tag, "----- %lu of %lu blocks requested, %lu copied from %s, %lu kept in place -----",
+             (unsigned long)(p_ctx->count - copied_count - in_place_count), (unsigned long)p_ctx->count,
+             (unsigned long)copied_count, p_ctx->running->label, (unsigned long)in_place_count);
+}
+
+/**
+ * @brief Hash every whole block of the running image and sort them by hash. Without an index every block
+ * is requested, which only costs transfer time
+ *
+ * @param p_out_count [out]: Number of entries
+ * @return block_index_entry_t* Index to be freed, NULL when the running image cannot be read
+ */
+static block_index_entry_t *build_running_index(uint32_t * p_out_count)
+{
+    const esp_partition_pos_t pos = { .offset = p_ctx->running->address, .size = p_ctx->running->size };
+    esp_image_metadata_t metadata = {};
+
+    *p_out_count = 0;
+
+    if (esp_image_get_metadata(&pos, &metadata) != ESP_OK)
+    {
+        ESP_LOGW(tag, "----- Running image not readable, every block is requested -----");
+        return NULL;
+    }
+
+    uint32_t count = metadata.image_len / OTA_BLOCKS_BLOCK_LEN_BYTES;
+    block_index_entry_t *p_index = (count > 0) ? malloc(count * sizeof(block_index_entry_t)) : NULL;
+    if (p_index == NULL)
+    {
+        ESP_LOGW(tag, "----- Running image not indexed, every block is requested -----");
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint8_t hash[HASH_SIZE_IN_BYTES] = {};
+
+        p_index[i].offset = i * OTA_BLOCKS_BLOCK_LEN_BYTES;
+
+        if (hash_block(p_ctx->running, p_index[i].offset, OTA_BLOCKS_BLOCK_LEN_BYTES, hash) != ERR_CODE_OK)
+        {
+            free(p_index);
+            return NULL;
+        }
+
+        memcpy(p_index[i].hash, hash, OTA_BLOCKS_HASH_LEN);
+    }
+
+    qsort(p_index, count, sizeof(block_index_entry_t), compare_entries);
+    *p_out_count = count;
+
+    return p_index;
+}
+
+/**
+ * @brief Check whether the update partition already holds a block at its offset
+ *
+ * @param block [in]: Block number
+ * @param p_hash [in]: Truncated hash sent by the client
+ * @return true when the hashes match
+ */
+static bool is_in_place(const uint32_t block, const uint8_t * p_hash)
+{
+    uint8_t hash[HASH_SIZE_IN_BYTES] = {};
+
+    if (hash_block(p_ctx->update, block * OTA_BLOCKS_BLOCK_LEN_BYTES, get_block_len(block), hash) != ERR_CODE_OK)
+    {
+        return false;
+    }
+
+    return (memcmp(hash, p_hash, OTA_BLOCKS_HASH_LEN) == 0);
+}
+
+/**
+ * @brief Read a block from flash and hash it
+ *
+ * @param p_partition [in]: Partition holding the block
+ * @param offset [in]: Block offset in the partition
+ * @param len [in]: Block length, at most OTA_BLOCKS_BLOCK_LEN_BYTES
+ * @param p_out_hash [out]: SHA-256 of the block
+ * @return types_error_code_e
+ */
+static types_error_code_e hash_block(const esp_partition_t * p_partition, const uint32_t offset, const uint32_t len, uint8_t * p_out_hash)
+{
+    if (esp_partition_read(p_partition, offset, p_ctx->block_buf, len) != ESP_OK)
+    {
+        ESP_LOGE(tag, "----- Failed to read partition %s -----", p_partition->label);
+        return ERR_CODE_FAIL;
+    }
+
+    return (mbedtls_sha256(p_ctx->block_buf, len, p_out_hash, 0) == 0) ? ERR_CODE_OK : ERR_CODE_FAIL;
+}
+
+/**
+ * @brief Hand the blocks available in flash to the sink, up to the next requested block
+ *
+ * @return types_error_code_e
+ */
+static types_error_code_e copy_local_blocks(void)
+{
+    while ((p_ctx->cursor < p_ctx->count) && (p_ctx->p_sources[p_ctx->cursor] != SOURCE_NEEDED))
+    {
+        uint32_t source = p_ctx->p_sources[p_ctx->cursor];
+        uint32_t len = get_block_len(p_ctx->cursor);
+        const esp_partition_t *p_partition = (source == SOURCE_IN_PLACE) ? p_ctx->update : p_ctx->running;
+        uint32_t offset = (source == SOURCE_IN_PLACE) ? (p_ctx->cursor * OTA_BLOCKS_BLOCK_LEN_BYTES) : source;
+
+        if (esp_partition_read(p_partition, offset, p_ctx->block_buf, len) != ESP_OK)
+        {
+            ESP_LOGE(tag, "----- Failed to read partition %s -----", p_partition->label);
+            return ERR_CODE_FAIL;
+        }
+
+        if (p_ctx->sink(p_ctx->block_buf, len) != ERR_CODE_IN_PROGRESS)
+        {
+            return ERR_CODE_FAIL;
+        }
+
+        p_ctx->cursor++;
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Length of a block, only the last one may be shorter
+ *
+ * @param block [in]: Block number
+ * @return uint32_t
+ */
+static uint32_t get_block_len(const uint32_t block)
+{
+    return MIN(p_ctx->image_size - (block * OTA_BLOCKS_BLOCK_LEN_BYTES), OTA_BLOCKS_BLOCK_LEN_BYTES);
+}
+
+/**
+ * @brief Order index entries by hash, for qsort and bsearch
+ *
+ * @param p_a [in]: First entry
+ * @param p_b [in]: Second entry
+ * @return int
+ */
+static int compare_entries(const void * p_a, const void * p_b)
+{
+    return memcmp(((const block_index_entry_t *)p_a)->hash, ((const block_index_entry_t *)p_b)->hash, OTA_BLOCKS_HASH_LEN);
+}
@@ -0,0 +1,29 @@
+#ifndef OTA_DECOMPRESSOR_H
+#define OTA_DECOMPRESSOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+#define OTA_DECOMPRESSOR_HASH_LEN       (32U)
+
+
+/**
+ * @brief Destination of the decompressed data
+ *
+ * Must return ERR_CODE_IN_PROGRESS while the data is accepted
+ */
+typedef types_error_code_e (*ota_decompressor_sink_t)(const uint8_t * p_data, const size_t len);
+
+
+types_error_code_e ota_decompressor_start(ota_decompressor_sink_t sink, const uint8_t * p_stream_hash);
+
+types_error_code_e ota_decompressor_feed(const uint8_t * p_data, const size_t len);
+
+types_error_code_e ota_decompressor_finish(void);
+
+void ota_decompressor_abort(void);
+
+#endif
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "rom/miniz.h"
+#include "mbedtls/sha256.h"
+#include "ota_decompressor.h"
+
+
+/* zlib stream, the ROM inflater also checks its Adler-32 */
+#define INFLATE_FLAGS           (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT)
+
+
+typedef struct {
+    tinfl_decompressor inflator;
+    uint8_t window[TINFL_LZ_DICT_SIZE];     /* Circular output buffer, also the deflate dictionary */
+    size_t window_ofs;
+    ota_decompressor_sink_t sink;
+    bool is_done;
+    bool check_stream_hash;
+    uint8_t stream_hash[OTA_DECOMPRESSOR_HASH_LEN];
+    mbedtls_sha256_context sha_ctx;
+} ota_decompressor_ctx_t;
+
+
+static const char *tag = "OTA_DECOMPRESSOR";
+
+static ota_decompressor_ctx_t *p_ctx = NULL;
+
+/**
+ * @brief Start a decompression session. The working memory (~43 KB) is only allocated for
+ * the duration of a compressed update
+ *
+ * @param sink [in]: Destination of the decompressed data
+ * @param p_stream_hash [in]: SHA-256 of the compressed stream, NULL to skip the check
+ * @return types_error_code_e
+ */
+types_error_code_e ota_decompressor_start(ota_decompressor_sink_t sink, const uint8_t * p_stream_hash)
+{
+    if (p_ctx != NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if (sink == NULL)
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    p_ctx = malloc(sizeof(ota_decompressor_ctx_t));
+    if (p_ctx == NULL)
+    {
+        ESP_LOGE(tag, "----- Not enough memory to decompress -----");
+        return ERR_CODE_FAIL;
+    }
+
+    tinfl_init(&p_ctx->inflator);
+    p_ctx->window_ofs = 0;
+    p_ctx->sink = sink;
+    p_ctx->is_done = false;
+    p_ctx->check_stream_hash = (p_stream_hash != NULL);
+
+    if (p_ctx->check_stream_hash)
+    {
+        memcpy(p_ctx->stream_hash, p_stream_hash, OTA_DECOMPRESSOR_HASH_LEN);
+        mbedtls_sha256_init(&p_ctx->sha_ctx);
+        mbedtls_sha256_starts(&p_ctx->sha_ctx, 0);
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Decompress a piece of the stream and hand the output to the sink
+ *
+ * @param p_data [in]: Compressed data buffer
+ * @param len [in]: Compressed data buffer length
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the stream is healthy, ERR_CODE_FAIL otherwise
+ */
+types_error_code_e ota_decompressor_feed(const uint8_t * p_data, const size_t len)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if (p_ctx->is_done)
+    {
+        ESP_LOGE(tag, "----- Data after the end of the stream -----");
+        return ERR_CODE_FAIL;
+    }
+
+    if (p_ctx->check_stream_hash)
+    {
+        mbedtls_sha256_update(&p_ctx->sha_ctx, p_data, len);
+    }
+
+    size_t in_ofs = 0;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+
+    do
+    {
+        size_t in_len = len - in_ofs;
+        size_t out_len = TINFL_LZ_DICT_SIZE - p_ctx->window_ofs;
+
+        status = tinfl_decompress(&p_ctx->inflator, p_data + in_ofs, &in_len,
+                                  p_ctx->window, p_ctx->window + p_ctx->window_ofs, &out_len, INFLATE_FLAGS);
+        in_ofs += in_len;
+
+        if (out_len > 0)
+        {
+            if (p_ctx->sink(p_ctx->window + p_ctx->window_ofs, out_len) != ERR_CODE_IN_PROGRESS)
+            {
+                return ERR_CODE_FAIL;
+            }
+
+            p_ctx->window_ofs = (p_ctx->window_ofs + out_len) & (TINFL_LZ_DICT_SIZE - 1U);
+        }
+
+        if (status < TINFL_STATUS_DONE)
+        {
+            ESP_LOGE(tag, "----- Corrupted stream (%d) -----", (int)status);
+            return ERR_CODE_FAIL;
+        }
+
+        if (status == TINFL_STATUS_DONE)
+        {
+            p_ctx->is_done = true;
+
+            if (in_ofs < len)
+            {
+                ESP_LOGE(tag, "----- Data after the end of the stream -----");
+                return ERR_CODE_FAIL;
+            }
+        }
+
+    } while ((status == TINFL_STATUS_HAS_MORE_OUTPUT) || ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && (in_ofs < len)));
+
+    return ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Check that the whole stream was decompressed and matches its hash, then release the session
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_decompressor_finish(void)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    types_error_code_e err = ERR_CODE_OK;
+
+    if (!p_ctx->is_done)
+    {
+        ESP_LOGE(tag, "----- Truncated stream -----");
+        err = ERR_CODE_FAIL;
+    }
+    else if (p_ctx->check_stream_hash)
+    {
+        uint8_t calc_hash[OTA_DECOMPRESSOR_HASH_LEN] = {};
+
+        if ((mbedtls_sha256_finish(&p_ctx->sha_ctx, calc_hash) != 0) ||
+            (memcmp(calc_hash, p_ctx->stream_hash, sizeof(calc_hash)) != 0))
+        {
+            ESP_LOGE(tag, "----- Compressed stream hash mismatch -----");
+            err = ERR_CODE_FAIL;
+        }
+    }
+
+    ota_decompressor_abort();
+
+    return err;
+}
+
+/**
+ * @brief Release the decompression session
+ *
+ */
+void ota_decompressor_abort(void)
+{
+    if (p_ctx == NULL)
+    {
+        return;
+    }
+
+    if (p_ctx->check_stream_hash)
+    {
+        mbedtls_sha256_free(&p_ctx->sha_ctx);
+    }
+
+    free(p_ctx);
+    p_ctx = NULL;
+}
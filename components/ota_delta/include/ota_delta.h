@@ -0,0 +1,29 @@
+#ifndef OTA_DELTA_H
+#define OTA_DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+#define OTA_DELTA_OLD_BUF_LEN_BYTES     (1024U)
+
+
+/**
+ * @brief Destination of the reconstructed image
+ *
+ * Must return ERR_CODE_IN_PROGRESS while the data is accepted
+ */
+typedef types_error_code_e (*ota_delta_sink_t)(const uint8_t * p_data, const size_t len);
+
+
+types_error_code_e ota_delta_start(ota_delta_sink_t sink);
+
+types_error_code_e ota_delta_feed(const uint8_t * p_data, const size_t len);
+
+types_error_code_e ota_delta_finish(void);
+
+void ota_delta_abort(void);
+
+#endif
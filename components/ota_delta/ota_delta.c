@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/param.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "ota_delta.h"
+
+
+/* ------------------- PATCH FORMAT -------------------
+ * The patch is a sequence of bsdiff-like records, little endian:
+ * diff length (4) | extra length (4) | seek (4, signed) | diff bytes | extra bytes
+ * Each diff byte is added to the byte of the running image at the old offset, extra bytes
+ * are copied as they are, then the old offset moves by seek. The patch ends after the last
+ * record, the image size and hash are checked by ota_manager.
+ */
+#define CONTROL_SIZE_IN_BYTES       (12U)
+
+
+typedef enum {
+    DELTA_READ_CONTROL,
+    DELTA_DIFF,
+    DELTA_EXTRA
+} ota_delta_states_e;
+
+typedef struct {
+    ota_delta_states_e state;
+    const esp_partition_t *old_partition;
+    int64_t old_pos;
+    uint32_t diff_left;
+    uint32_t extra_left;
+    int32_t seek;
+    uint8_t control[CONTROL_SIZE_IN_BYTES];
+    uint8_t control_len;
+    uint8_t old_buf[OTA_DELTA_OLD_BUF_LEN_BYTES];
+    ota_delta_sink_t sink;
+} ota_delta_ctx_t;
+
+
+static const char *tag = "OTA_DELTA";
+
+static ota_delta_ctx_t *p_ctx = NULL;
+
+
+static types_error_code_e apply_diff(const uint8_t * p_data, const size_t len);
+static void parse_control(void);
+static uint32_t get_u32_le(const uint8_t * p_data);
+
+/**
+ * @brief Start applying a patch against the running partition
+ *
+ * @param sink [in]: Destination of the reconstructed image
+ * @return types_error_code_e
+ */
+types_error_code_e ota_delta_start(ota_delta_sink_t sink)
+{
+    if (p_ctx != NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if (sink == NULL)
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (running == NULL)
+    {
+        ESP_LOGE(tag, "----- Running partition not found -----");
+        return ERR_CODE_FAIL;
+    }
+
+    p_ctx = malloc(sizeof(ota_delta_ctx_t));
+    if (p_ctx == NULL)
+    {
+        ESP_LOGE(tag, "----- Not enough memory to apply the patch -----");
+        return ERR_CODE_FAIL;
+    }
+
+    p_ctx->state = DELTA_READ_CONTROL;
+    p_ctx->old_partition = running;
+    p_ctx->old_pos = 0;
+    p_ctx->diff_left = 0;
+    p_ctx->extra_left = 0;
+    p_ctx->seek = 0;
+    p_ctx->control_len = 0;
+    p_ctx->sink = sink;
+
+    ESP_LOGI(tag, "----- Patching against partition %s -----", running->label);
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Apply a piece of the patch and hand the reconstructed bytes to the sink
+ *
+ * @param p_data [in]: Patch data buffer
+ * @param len [in]: Patch data buffer length
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the patch is healthy, ERR_CODE_FAIL otherwise
+ */
+types_error_code_e ota_delta_feed(const uint8_t * p_data, const size_t len)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    size_t offset = 0;
+
+    while (offset < len)
+    {
+        size_t chunk_len = 0;
+
+        switch (p_ctx->state)
+        {
+            case DELTA_READ_CONTROL:
+                chunk_len = MIN(len - offset, (size_t)(CONTROL_SIZE_IN_BYTES - p_ctx->control_len));
+                memcpy(p_ctx->control + p_ctx->control_len, p_data + offset, chunk_len);
+                p_ctx->control_len += chunk_len;
+
+                if (p_ctx->control_len == CONTROL_SIZE_IN_BYTES)
+                {
+                    parse_control();
+                }
+            break;
+
+            case DELTA_DIFF:
+                chunk_len = MIN(len - offset, (size_t)p_ctx->diff_left);
+                chunk_len = MIN(chunk_len, sizeof(p_ctx->old_buf));
+
+                if (apply_diff(p_data + offset, chunk_len) != ERR_CODE_OK)
+                {
+                    return ERR_CODE_FAIL;
+                }
+
+                p_ctx->diff_left -= chunk_len;
+                p_ctx->old_pos += chunk_len;
+            break;
+
+            case DELTA_EXTRA:
+                chunk_len = MIN(len - offset, (size_t)p_ctx->extra_left);
+
+                if (p_ctx->sink(p_data + offset, chunk_len) != ERR_CODE_IN_PROGRESS)
+                {
+                    return ERR_CODE_FAIL;
+                }
+
+                p_ctx->extra_left -= chunk_len;
+            break;
+
+            default:
+            return ERR_CODE_FAIL;
+        }
+
+        offset += chunk_len;
+
+        /* Move to the next section as soon as the current one is complete, empty sections are skipped */
+        if ((p_ctx->state == DELTA_DIFF) && (p_ctx->diff_left == 0))
+        {
+            p_ctx->state = DELTA_EXTRA;
+        }
+
+        if ((p_ctx->state == DELTA_EXTRA) && (p_ctx->extra_left == 0))
+        {
+            p_ctx->old_pos += p_ctx->seek;
+            p_ctx->state = DELTA_READ_CONTROL;
+        }
+    }
+
+    return ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Check that the patch ended on a record boundary, then release the session
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_delta_finish(void)
+{
+    if (p_ctx == NULL)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    types_error_code_e err = ERR_CODE_OK;
+
+    if ((p_ctx->state != DELTA_READ_CONTROL) || (p_ctx->control_len != 0))
+    {
+        ESP_LOGE(tag, "----- Truncated patch -----");
+        err = ERR_CODE_FAIL;
+    }
+
+    ota_delta_abort();
+
+    return err;
+}
+
+/**
+ * @brief Release the patch session
+ *
+ */
+void ota_delta_abort(void)
+{
+    free(p_ctx);
+    p_ctx = NULL;
+}
+
+/**
+ * @brief Add diff bytes to the running image and hand the result to the sink
+ *
+ * @param p_data [in]: Diff bytes
+ * @param len [in]: Diff bytes length, at most OTA_DELTA_OLD_BUF_LEN_BYTES
+ * @return types_error_code_e
+ */
+static types_error_code_e apply_diff(const uint8_t * p_data, const size_t len)
+{
+    if ((p_ctx->old_pos < 0) || ((p_ctx->old_pos + (int64_t)len) > (int64_t)p_ctx->old_partition->size))
+    {
+        ESP_LOGE(tag, "----- Patch reads outside of the running partition -----");
+        return ERR_CODE_FAIL;
+    }
+
+    if (esp_partition_read(p_ctx->old_partition, (size_t)p_ctx->old_pos, p_ctx->old_buf, len) != ESP_OK)
+    {
+        ESP_LOGE(tag, "----- Failed to read the running partition -----");
+        return ERR_CODE_FAIL;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        p_ctx->old_buf[i] += p_data[i];
+    }
+
+    return (p_ctx->sink(p_ctx->old_buf, len) == ERR_CODE_IN_PROGRESS) ? ERR_CODE_OK : ERR_CODE_FAIL;
+}
+
+/**
+ * @brief Parse a complete control record and start its diff section
+ *
+ */
+static void parse_control(void)
+{
+    p_ctx->diff_left = get_u32_le(p_ctx->control);
+    p_ctx->extra_left = get_u32_le(p_ctx->control + 4U);
+    p_ctx->seek = (int32_t)get_u32_le(p_ctx->control + 8U);
+    p_ctx->control_len = 0;
+
+    p_ctx->state = DELTA_DIFF;
+}
+
+/**
+ * @brief Read a little endian 32 bits value
+ *
+ * @param p_data [in]: Data buffer
+ * @return uint32_t
+ */
+static uint32_t get_u32_le(const uint8_t * p_data)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        value |= ((uint32_t)p_data[i]) << (8U * i);
+    }
+
+    return value;
+}
@@ -0,0 +1,27 @@
+#ifndef OTA_HASH_CACHE_H
+#define OTA_HASH_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_partition.h"
+#include "types.h"
+
+
+#define OTA_HASH_CACHE_HASH_LEN             (32U)
+#define OTA_HASH_CACHE_MAX_PARTITIONS       (4U)            /* Factory and OTA app partitions tracked */
+#define OTA_HASH_CACHE_CHUNK_BYTES          (64U * 1024U)   /* Mapped and hashed at once by the idle task, one MMU page */
+#define OTA_HASH_CACHE_START_DELAY_MS       (5000U)         /* Lets the boot and the first connections settle */
+
+
+types_error_code_e ota_hash_cache_init(void);
+
+void ota_hash_cache_invalidate(const esp_partition_t * p_partition);
+
+void ota_hash_cache_store(const esp_partition_t * p_partition, const uint32_t image_size, const uint8_t * p_hash);
+
+void ota_hash_cache_resume(void);
+
+const esp_partition_t *ota_hash_cache_find(const uint32_t image_size, const uint8_t * p_hash);
+
+#endif
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#include "ota_hash_cache.h"
+
+
+#define NVS_NAMESPACE               "ota_hashes"
+#define NVS_KEY_FORMAT              "p%08" PRIx32       /* Partition address */
+#define NVS_KEY_LEN                 (16U)
+
+#define TASK_STACK_SIZE             (4096U)
+#define TASK_PRIORITY               (tskIDLE_PRIORITY + 1U)
+
+
+/* NVS entry, one per partition */
+typedef struct {
+    uint32_t address;
+    uint32_t image_size;
+    uint8_t hash[OTA_HASH_CACHE_HASH_LEN];
+    uint8_t app_elf_sha256[OTA_HASH_CACHE_HASH_LEN];    /* Tells an image flashed over the serial port since */
+} cache_entry_t;
+
+typedef struct {
+    const esp_partition_t *p_partition;
+    cache_entry_t entry;
+    bool is_valid;
+    bool is_skipped;    /* No image to hash, or written by an update since boot */
+} cache_slot_t;
+
+
+static const char *tag = "OTA_HASH_CACHE";
+
+static struct {
+    cache_slot_t slots[OTA_HASH_CACHE_MAX_PARTITIONS];
+    uint8_t count;
+    volatile bool is_paused;        /* An update is writing, the SHA accelerator and the flash are left to it */
+    SemaphoreHandle_t semaphore;
+    SemaphoreHandle_t wake;
+} cache = {};
+
+
+static void add_partition(const esp_partition_t * p_partition);
+static cache_slot_t *find_slot(const esp_partition_t * p_partition);
+static void read_fingerprint(const esp_partition_t * p_partition, uint8_t * p_out_fingerprint);
+static bool load_entry(cache_slot_t * p_slot);
+static void save_entry_locked(const cache_slot_t * p_slot);
+static void erase_entry_locked(const cache_slot_t * p_slot);
+static types_error_code_e hash_partition(const esp_partition_t * p_partition, const uint32_t image_size, uint8_t * p_out_hash);
+static void hash_pending_partitions(void);
+static void hash_task(void * p_params);
+
+/**
+ * @brief Load the cached hashes of the app partitions and start the task hashing the others when idle
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_hash_cache_init(void)
+{
+    cache.semaphore = xSemaphoreCreateMutex();
+    cache.wake = xSemaphoreCreateBinary();
+    if ((cache.semaphore == NULL) || (cache.wake == NULL))
+    {
+        ESP_LOGE(tag, "----- Failed to create hash cache semaphores -----");
+        return ERR_CODE_FAIL;
+    }
+
+    add_partition(esp_partition_find_first(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_FACTORY, NULL));
+    for (uint8_t i = 0; i < OTA_HASH_CACHE_MAX_PARTITIONS; i++)
+    {
+        add_partition(esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+                                               (esp_partition_subtype_t)(ESP_PARTITION_SUBTYPE_APP_OTA_MIN + i), NULL));
+    }
+
+    for (uint8_t i = 0; i < cache.count; i++)
+    {
+        cache.slots[i].is_valid = load_entry(&cache.slots[i]);
+    }
+
+    if (xTaskCreate(hash_task, "ota_hash_cache", TASK_STACK_SIZE, NULL, TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGE(tag, "----- Failed to create hash cache task -----");
+        return ERR_CODE_FAIL;
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Drop the cached hash of a partition about to be written, and pause the idle hashing until
+ * ota_hash_cache_store or ota_hash_cache_resume
+ *
+ * @param p_partition [in]: Partition to be written
+ */
+void ota_hash_cache_invalidate(const esp_partition_t * p_partition)
+{
+    if (cache.semaphore == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+
+    cache.is_paused = true;
+
+    cache_slot_t *p_slot = find_slot(p_partition);
+    if (p_slot != NULL)
+    {
+        if (p_slot->is_valid)
+        {
+            erase_entry_locked(p_slot);
+        }
+        p_slot->is_valid = false;
+        p_slot->is_skipped = true;
+    }
+
+    xSemaphoreGive(cache.semaphore);
+}
+
+/**
+ * @brief Cache the hash of an image just written and verified, and resume the idle hashing
+ *
+ * @param p_partition [in]: Partition written
+ * @param image_size [in]: Image size in bytes
+ * @param p_hash [in]: Image SHA-256, OTA_HASH_CACHE_HASH_LEN bytes
+ */
+void ota_hash_cache_store(const esp_partition_t * p_partition, const uint32_t image_size, const uint8_t * p_hash)
+{
+    if (cache.semaphore == NULL)
+    {
+        return;
+    }
+
+    cache_entry_t entry = { .address = p_partition->address, .image_size = image_size };
+    memcpy(entry.hash, p_hash, OTA_HASH_CACHE_HASH_LEN);
+    read_fingerprint(p_partition, entry.app_elf_sha256);
+
+    xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+
+    cache_slot_t *p_slot = find_slot(p_partition);
+    if (p_slot != NULL)
+    {
+        p_slot->entry = entry;
+        p_slot->is_valid = true;
+        save_entry_locked(p_slot);
+    }
+
+    cache.is_paused = false;
+
+    xSemaphoreGive(cache.semaphore);
+    xSemaphoreGive(cache.wake);
+}
+
+/**
+ * @brief Resume the idle hashing after an update that did not complete
+ */
+void ota_hash_cache_resume(void)
+{
+    if (cache.semaphore == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+    cache.is_paused = false;
+    xSemaphoreGive(cache.semaphore);
+    xSemaphoreGive(cache.wake);
+}
+
+/**
+ * @brief Look for a partition holding an image
+ *
+ * @param image_size [in]: Image size in bytes
+ * @param p_hash [in]: Image SHA-256, OTA_HASH_CACHE_HASH_LEN bytes
+ * @return const esp_partition_t* Partition holding the image, NULL when none or its hash is not cached yet
+ */
+const esp_partition_t *ota_hash_cache_find(const uint32_t image_size, const uint8_t * p_hash)
+{
+    const esp_partition_t *p_found = NULL;
+
+    if (cache.semaphore == NULL)
+    {
+        return NULL;
+    }
+
+    xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+
+    for (uint8_t i = 0; (i < cache.count) && (p_found == NULL); i++)
+    {
+        const cache_slot_t *p_slot = &cache.slots[i];
+
+        if (p_slot->is_valid && (p_slot->entry.image_size == image_size) &&
+            (memcmp(p_slot->entry.hash, p_hash, OTA_HASH_CACHE_HASH_LEN) == 0))
+        {
+            p_found = p_slot->p_partition;
+        }
+    }
+
+    xSemaphoreGive(cache.semaphore);
+
+    return p_found;
+}
+
+static void add_partition(const esp_partition_t * p_partition)
+{
+    if ((p_partition != NULL) && (cache.count < OTA_HASH_CACHE_MAX_PARTITIONS))
+    {
+        cache.slots[cache.count].p_partition = p_partition;
+        cache.count++;
+    }
+}
+
+static cache_slot_t *find_slot(const esp_partition_t * p_partition)
+{
+    for (uint8_t i = 0; i < cache.count; i++)
+    {
+        if ((p_partition != NULL) && (cache.slots[i].p_partition->address == p_partition->address))
+        {
+            return &cache.slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief ELF SHA-256 of the application description, zeros when the partition holds no application
+ */
+static void read_fingerprint(const esp_partition_t * p_partition, uint8_t * p_out_fingerprint)
+{
+    esp_app_desc_t app_desc = {};
+
+    if (esp_ota_get_partition_description(p_partition, &app_desc) == ESP_OK)
+    {
+        memcpy(p_out_fingerprint, app_desc.app_elf_sha256, OTA_HASH_CACHE_HASH_LEN);
+    }
+    else
+    {
+        memset(p_out_fingerprint, 0, OTA_HASH_CACHE_HASH_LEN);
+    }
+}
+
+/**
+ * @brief Read the entry of a partition, valid while the partition still holds the image it describes
+ */
+static bool load_entry(cache_slot_t * p_slot)
+{
+    nvs_handle_t nvs_handle;
+    char key[NVS_KEY_LEN] = {};
+    size_t len = sizeof(p_slot->entry);
+    uint8_t fingerprint[OTA_HASH_CACHE_HASH_LEN] = {};
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    snprintf(key, sizeof(key), NVS_KEY_FORMAT, p_slot->p_partition->address);
+    esp_err_t err = nvs_get_blob(nvs_handle, key, &p_slot->entry, &len);
+    nvs_close(nvs_handle);
+
+    if ((err != ESP_OK) || (len != sizeof(p_slot->entry)) ||
+        (p_slot->entry.address != p_slot->p_partition->address) ||
+        (p_slot->entry.image_size > p_slot->p_partition->size))
+    {
+        return false;
+    }
+
+    read_fingerprint(p_slot->p_partition, fingerprint);
+
+    return memcmp(fingerprint, p_slot->entry.app_elf_sha256, sizeof(fingerprint)) == 0;
+}
+
+static void save_entry_locked(const cache_slot_t * p_slot)
+{
+    nvs_handle_t nvs_handle;
+    char key[NVS_KEY_LEN] = {};
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK)
+    {
+        ESP_LOGW(tag, "----- Failed to open hash cache storage -----");
+        return;
+    }
+
+    snprintf(key, sizeof(key), NVS_KEY_FORMAT, p_slot->p_partition->address);
+    if ((nvs_set_blob(nvs_handle, key, &p_slot->entry, sizeof(p_slot->entry)) != ESP_OK) ||
+        (nvs_commit(nvs_handle) != ESP_OK))
+    {
+        ESP_LOGW(tag, "----- Failed to save the hash of %s -----", p_slot->p_partition->label);
+    }
+
+    nvs_close(nvs_handle);
+}
+
+static void erase_entry_locked(const cache_slot_t * p_slot)
+{
+    nvs_handle_t nvs_handle;
+    char key[NVS_KEY_LEN] = {};
+
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK)
+    {
+        return;
+    }
+
+    snprintf(key, sizeof(key), NVS_KEY_FORMAT, p_slot->p_partition->address);
+    if (nvs_erase_key(nvs_handle, key) == ESP_OK)
+    {
+        nvs_commit(nvs_handle);
+    }
+
+    nvs_close(nvs_handle);
+}
+
+/**
+ * @brief Hash an image through the flash cache, OTA_HASH_CACHE_CHUNK_BYTES at a time. Gives up between
+ * chunks once an update starts, so the update gets the SHA accelerator back within one chunk
+ */
+static types_error_code_e hash_partition(const esp_partition_t * p_partition, const uint32_t image_size, uint8_t * p_out_hash)
+{
+    mbedtls_sha256_context sha_ctx;
+    int ret = 0;
+
+    mbedtls_sha256_init(&sha_ctx);
+    mbedtls_sha256_starts(&sha_ctx, 0);
+
+    for (uint32_t offset = 0; (offset < image_size) && (ret == 0); offset += OTA_HASH_CACHE_CHUNK_BYTES)
+    {
+        uint32_t len = ((image_size - offset) < OTA_HASH_CACHE_CHUNK_BYTES) ? (image_size - offset) : OTA_HASH_CACHE_CHUNK_BYTES;
+        const void *p_mapped = NULL;
+        esp_partition_mmap_handle_t mmap_handle = 0;
+
+        if (cache.is_paused ||
+            (esp_partition_mmap(p_partition, offset, len, ESP_PARTITION_MMAP_DATA, &p_mapped, &mmap_handle) != ESP_OK))
+        {
+            ret = -1;
+            break;
+        }
+
+        ret = mbedtls_sha256_update(&sha_ctx, p_mapped, len);
+        esp_partition_munmap(mmap_handle);
+    }
+
+    if (ret == 0)
+    {
+        ret = mbedtls_sha256_finish(&sha_ctx, p_out_hash);
+    }
+
+    mbedtls_sha256_free(&sha_ctx);
+
+    return (ret == 0) ? ERR_CODE_OK : ERR_CODE_FAIL;
+}
+
+/**
+ * @brief Hash every partition with an image and no valid entry, until done or an update starts
+ */
+static void hash_pending_partitions(void)
+{
+    for (uint8_t i = 0; (i < cache.count) && !cache.is_paused; i++)
+    {
+        cache_slot_t *p_slot = &cache.slots[i];
+
+        xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+        bool is_pending = !p_slot->is_valid && !p_slot->is_skipped;
+        xSemaphoreGive(cache.semaphore);
+
+        if (!is_pending)
+        {
+            continue;
+        }
+
+        const esp_partition_pos_t pos = { .offset = p_slot->p_partition->address, .size = p_slot->p_partition->size };
+        esp_image_metadata_t metadata = {};
+        cache_entry_t entry = { .address = p_slot->p_partition->address };
+
+        if (esp_image_get_metadata(&pos, &metadata) != ESP_OK)
+        {
+            xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+            p_slot->is_skipped = true;
+            xSemaphoreGive(cache.semaphore);
+            continue;
+        }
+
+        entry.image_size = metadata.image_len;
+        if (hash_partition(p_slot->p_partition, entry.image_size, entry.hash) != ERR_CODE_OK)
+        {
+            continue;
+        }
+        read_fingerprint(p_slot->p_partition, entry.app_elf_sha256);
+
+        xSemaphoreTake(cache.semaphore, portMAX_DELAY);
+        /* An update may have started, or even completed, while hashing */
+        if (!cache.is_paused && !p_slot->is_valid && !p_slot->is_skipped)
+        {
+            p_slot->entry = entry;
+            p_slot->is_valid = true;
+            save_entry_locked(p_slot);
+            ESP_LOGI(tag, "----- Hash of %s cached -----", p_slot->p_partition->label);
+        }
+        xSemaphoreGive(cache.semaphore);
+    }
+}
+
+static void hash_task(void * p_params)
+{
+    vTaskDelay(pdMS_TO_TICKS(OTA_HASH_CACHE_START_DELAY_MS));
+
+    while (1)
+    {
+        hash_pending_partitions();
+        xSemaphoreTake(cache.wake, portMAX_DELAY);
+    }
+}
@@ -6,8 +6,38 @@
 #include <stdbool.h>
 #include "types.h"
 
+#define OTA_CHECKPOINT_INTERVAL_BYTES   (64U * 1024U) /* Multiple of the flash sector size */
+
+/* Hash the image back from flash before switching the boot partition, build with -DOTA_READBACK_VERIFY=0 to skip it */
+#ifndef OTA_READBACK_VERIFY
+#define OTA_READBACK_VERIFY             (1)
+#endif
+#define OTA_READBACK_CHUNK_BYTES        (256U * 1024U) /* Mapped and hashed at once, multiple of the 64 KB MMU page */
+
+/* Compare each sector with what the update partition already holds and only erase and program the ones that
+ * differ, build with -DOTA_SKIP_UNCHANGED=1. Sectors are then erased one at a time as the blocks arrive, which
+ * is slower than the block erase ahead of the writes when most of them changed */
+#ifndef OTA_SKIP_UNCHANGED
+#define OTA_SKIP_UNCHANGED              (0)
+#endif
+
+/* Erase the image range from a background task ahead of the write cursor instead of in esp_ota_begin,
+ * build with -DOTA_ERASE_AHEAD=0 to erase it all before the first block */
+#ifndef OTA_ERASE_AHEAD
+#define OTA_ERASE_AHEAD                 (!OTA_SKIP_UNCHANGED)
+#endif
+
+#if OTA_SKIP_UNCHANGED && OTA_ERASE_AHEAD
+#error "OTA_SKIP_UNCHANGED compares sectors before erasing them, it cannot be combined with OTA_ERASE_AHEAD"
+#endif
+#define OTA_ERASE_CHUNK_BYTES           (64U * 1024U) /* Erased at once, matches the flash block erase */
+
 types_error_code_e ota_process_init(const size_t, const uint8_t*);
+types_error_code_e ota_process_use_present(const size_t, const uint8_t*, bool*);
+types_error_code_e ota_process_get_resume_offset(const size_t, const uint8_t*, size_t*);
+types_error_code_e ota_process_resume(const size_t, const uint8_t*, const size_t);
 types_error_code_e ota_process_write_block(const uint8_t*, const size_t);
+types_error_code_e ota_process_verify_block(const uint8_t*, const size_t);
 types_error_code_e ota_process_end(bool);
 
 void ota_check_rollback(bool);
@@ -1,12 +1,39 @@
 #include <string.h>
+#include <sys/param.h>
 #include "ota_manager.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_ota_ops.h"
 #include "esp_partition.h"
 #include "esp_log.h"
+#include "nvs.h"
 #include "mbedtls/sha256.h"
+#include "ota_metrics.h"
+#include "ota_hash_cache.h"
 
 #define HASH_SIZE_IN_BYTES                  (32U)
 
+#define CHECKPOINT_NVS_NAMESPACE            "ota_resume"
+#define CHECKPOINT_NVS_KEY                  "checkpoint"
+
+#define ERASE_PINNED_CORE                   (0) // Next to the writer task, which it only runs ahead of
+#define ERASE_TASK_STACK_SIZE               (3072U)
+#define ERASE_TASK_PRIORITY                 (2U) // Below the writer, erases while it waits for data
+
+/**
+ * @brief Progress persisted in NVS so an interrupted update can be resumed.
+ * The SHA-256 context is stored as a software copy (see mbedtls_sha256_clone), so the blob
+ * is only valid for the firmware that wrote it, which the size check on load enforces.
+ */
+typedef struct {
+    uint32_t partition_address;
+    uint32_t img_size;
+    uint8_t hash[HASH_SIZE_IN_BYTES];
+    uint32_t offset;
+    mbedtls_sha256_context sha_ctx;
+} ota_checkpoint_t;
+
 static const char *TAG = "OTA";
 
 static const esp_partition_t *ota_partition = NULL;
@@ -14,11 +41,33 @@ static esp_ota_handle_t ota_handle = 0;
 static mbedtls_sha256_context sha_ctx;
 static bool ota_in_progress = false;
 static size_t fmw_size = 0;
-static size_t updated_fmw_size = 0;
+static size_t updated_fmw_size = 0; // Bytes flashed and hashed
+static size_t written_fmw_size = 0; // Bytes flashed, ahead of updated_fmw_size while blocks wait to be hashed
 static uint8_t sent_hash[HASH_SIZE_IN_BYTES] = {0};
+static size_t skipped_fmw_size = 0; // Bytes the update partition already held, neither erased nor programmed
+static size_t erased_fmw_size = 0; // End of the last sector erased by ota_write_changed
+
+// Background erase of the image range, writes wait until the watermark passes them
+static struct {
+    const esp_partition_t *partition;
+    size_t end;                 // Bytes to erase from the partition start
+    volatile size_t watermark;  // Bytes erased so far
+    volatile bool is_running;
+    volatile bool stop;
+    SemaphoreHandle_t progress; // Given after each erased chunk and when the task exits
+} eraser = {};
 
 static int ota_process_compute_hash(uint8_t *out_sha256);
 static types_error_code_e ota_compare_hashes(const uint8_t *recv_hash, const uint8_t *calc_hash);
+static bool ota_checkpoint_load(ota_checkpoint_t *checkpoint);
+static void ota_checkpoint_save(void);
+static void ota_checkpoint_clear(void);
+static types_error_code_e ota_readback_verify(void);
+static esp_err_t ota_write_changed(const uint8_t *data, const size_t data_len);
+static esp_err_t ota_erase_start(const esp_partition_t *partition, const size_t from, const size_t img_size);
+static esp_err_t ota_erase_wait(const size_t end);
+static void ota_erase_stop(void);
+static void ota_erase_task(void *params);
 
 /**
  * @brief Initializes an Over-The-Air (OTA) update process by setting the firmware size, copying the hash, 
@@ -39,6 +88,7 @@ types_error_code_e ota_process_init(const size_t img_size, const uint8_t* hash)
     fmw_size = img_size;
     memcpy(sent_hash, hash, HASH_SIZE_IN_BYTES);
 
+    ota_erase_stop();
 
     ota_partition = esp_ota_get_next_update_partition(NULL);
     if (!ota_partition) { // Invalid OTA partition
@@ -48,26 +98,198 @@ types_error_code_e ota_process_init(const size_t img_size, const uint8_t* hash)
 
     ESP_LOGI(TAG, "Initializing OTA to partition: %s", ota_partition->label);
 
+    // The cached hash no longer describes the partition, and the idle hashing waits for the update
+    ota_hash_cache_invalidate(ota_partition);
+
+    // A fresh update erases the partition, so any previous progress is lost
+    ota_checkpoint_clear();
+
     // Allocates memory for the OTA partition
+    int64_t start_us = ota_metrics_start();
+#if OTA_ERASE_AHEAD
+    // The handle is opened without erasing, the first block only waits for the first erased chunk
+    ESP_ERROR_CHECK(ota_erase_start(ota_partition, 0, fmw_size));
+    ESP_ERROR_CHECK(esp_ota_resume(ota_partition, fmw_size, 0, &ota_handle));
+#elif OTA_SKIP_UNCHANGED
+    // Nothing is erased up front, ota_write_changed only erases the sectors whose content changes
+    ESP_ERROR_CHECK(esp_ota_resume(ota_partition, fmw_size, 0, &ota_handle));
+#else
     ESP_ERROR_CHECK(esp_ota_begin(ota_partition, fmw_size, &ota_handle));
+#endif
+    ota_metrics_stop(OTA_METRICS_PHASE_OTA_BEGIN, start_us);
 
     // Initialize the context and starts the message digest computation
     mbedtls_sha256_init(&sha_ctx);
     mbedtls_sha256_starts(&sha_ctx, 0); // 0 for SHA-256
 
+    updated_fmw_size = 0;
+    written_fmw_size = 0;
+    skipped_fmw_size = 0;
+    erased_fmw_size = 0;
     ota_in_progress = true;
     return ERR_CODE_OK;
 }
 
 /**
- * @brief Writes a block of data to an ongoing Over-The-Air (OTA) update process, verifies the integrity 
- * of the data using SHA-256 hashing, and checks the firmware size against the expected size. 
- * It returns an error code indicating the status of the operation, such as success, failure, 
- * or in-progress, and handles errors like mismatched firmware size or hash computation failures.
+ * @brief Looks for the image among the app partitions whose hash is cached (see ota_hash_cache) and, 
+ * when found, makes that partition the boot partition without any transfer. Partitions that were 
+ * rolled back or aborted are ignored, so such an image is written again.
+ * 
+ * @param img_size Firmware size to be updated
+ * @param hash Received hash
+ * @param out_is_switched Output parameter, true when the boot partition changed, false when it already held the image
+ * @return types_error_code_e ERR_CODE_FAIL when no partition holds the image
+ */
+types_error_code_e ota_process_use_present(const size_t img_size, const uint8_t* hash, bool *out_is_switched) {
+
+    *out_is_switched = false;
+
+    if (ota_in_progress) { // The update partition may be the one holding the image
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    const esp_partition_t *partition = ota_hash_cache_find(img_size, hash);
+    if (!partition) {
+        return ERR_CODE_FAIL;
+    }
+
+    esp_ota_img_states_t state = ESP_OTA_IMG_UNDEFINED;
+    if ((esp_ota_get_state_partition(partition, &state) == ESP_OK) &&
+        ((state == ESP_OTA_IMG_INVALID) || (state == ESP_OTA_IMG_ABORTED))) {
+        return ERR_CODE_FAIL;
+    }
+
+    const esp_partition_t *boot_partition = esp_ota_get_boot_partition();
+    if (boot_partition && (boot_partition->address == partition->address)) {
+        ESP_LOGI(TAG, "Image already in the boot partition: %s", partition->label);
+        return ERR_CODE_OK;
+    }
+
+    if (esp_ota_set_boot_partition(partition) != ESP_OK) {
+        ESP_LOGE(TAG, "Error setting up partition %s holding the image", partition->label);
+        return ERR_CODE_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Image found in partition: %s, set as boot partition", partition->label);
+    *out_is_switched = true;
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Looks for a checkpoint of an interrupted update of the same image (size and hash) to the 
+ * current update partition and returns the offset the transfer can continue from.
+ * 
+ * @param img_size Firmware size to be updated
+ * @param hash Received hash
+ * @param out_offset Output parameter of resume offset, 0 when the update must start from scratch
+ * @return types_error_code_e
+ */
+types_error_code_e ota_process_get_resume_offset(const size_t img_size, const uint8_t* hash, size_t *out_offset) {
+
+    *out_offset = 0;
+
+    if (ota_in_progress) { // Progress of the ongoing update may not be flushed yet
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    ota_checkpoint_t checkpoint;
+    if (!ota_checkpoint_load(&checkpoint)) {
+        return ERR_CODE_OK;
+    }
+
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+
+    if ((partition != NULL) &&
+        (checkpoint.partition_address == partition->address) &&
+        (checkpoint.img_size == img_size) &&
+        (memcmp(checkpoint.hash, hash, HASH_SIZE_IN_BYTES) == 0) &&
+        (checkpoint.offset < img_size)) {
+        *out_offset = checkpoint.offset;
+    }
+
+    mbedtls_sha256_free(&checkpoint.sha_ctx);
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Resumes an interrupted Over-The-Air (OTA) update from a checkpoint found by 
+ * ota_process_get_resume_offset. The partition is not erased again and the SHA-256 computation 
+ * continues from the persisted state. Bytes written after the checkpoint are simply rewritten 
+ * with the same content.
+ * 
+ * @param img_size Firmware size to be updated
+ * @param hash Received hash
+ * @param offset Offset returned by ota_process_get_resume_offset
+ * @return types_error_code_e
+ */
+types_error_code_e ota_process_resume(const size_t img_size, const uint8_t* hash, const size_t offset) {
+
+    if (ota_in_progress) { // Update already in progress
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    ota_erase_stop();
+
+    ota_checkpoint_t checkpoint;
+    if (!ota_checkpoint_load(&checkpoint)) {
+        return ERR_CODE_FAIL;
+    }
+
+    ota_partition = esp_ota_get_next_update_partition(NULL);
+    if ((!ota_partition) ||
+        (checkpoint.partition_address != ota_partition->address) ||
+        (checkpoint.img_size != img_size) ||
+        (memcmp(checkpoint.hash, hash, HASH_SIZE_IN_BYTES) != 0) ||
+        (checkpoint.offset != offset)) { // Checkpoint changed since the offset was announced
+        mbedtls_sha256_free(&checkpoint.sha_ctx);
+        return ERR_CODE_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Resuming OTA to partition: %s at offset %u", ota_partition->label, (unsigned int)offset);
+
+    // Everything before the checkpoint is kept. What follows was not fully erased when the erase ran
+    // ahead of the writes, so it is erased again, the checkpoint offset being a sector boundary
+    ota_hash_cache_invalidate(ota_partition);
+
+    int64_t start_us = ota_metrics_start();
+    esp_err_t err = OTA_ERASE_AHEAD ? ota_erase_start(ota_partition, offset, img_size) : ESP_OK;
+    if (err == ESP_OK) {
+        err = esp_ota_resume(ota_partition, img_size, offset, &ota_handle);
+    }
+    ota_metrics_stop(OTA_METRICS_PHASE_OTA_BEGIN, start_us);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error resuming OTA");
+        mbedtls_sha256_free(&checkpoint.sha_ctx);
+        ota_hash_cache_resume();
+        return ERR_CODE_FAIL;
+    }
+
+    fmw_size = img_size;
+    updated_fmw_size = offset;
+    written_fmw_size = offset;
+    skipped_fmw_size = 0;
+    erased_fmw_size = offset;
+    memcpy(sent_hash, hash, HASH_SIZE_IN_BYTES);
+
+    // Continue the message digest computation from the persisted state
+    mbedtls_sha256_init(&sha_ctx);
+    memcpy(&sha_ctx, &checkpoint.sha_ctx, sizeof(sha_ctx));
+
+    ota_in_progress = true;
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Writes a block of data to an ongoing Over-The-Air (OTA) update process and checks the firmware 
+ * size against the expected size. The block must then be handed to ota_process_verify_block, in the same 
+ * order, which may run on another task while the next block is being written.
+ * A failed block leaves the update in progress, ota_process_end(false) releases it.
  * 
  * @param data Firmware block
  * @param data_len Firmware block size
- * @return types_error_code_e 
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS when the block was written
  */
 types_error_code_e ota_process_write_block(const uint8_t *data, const size_t data_len) {
 
@@ -75,35 +297,75 @@ types_error_code_e ota_process_write_block(const uint8_t *data, const size_t dat
         return ERR_CODE_NOT_ALLOWED;
     }
 
-    esp_err_t err = esp_ota_write(ota_handle, data, data_len);
+    if ((written_fmw_size + data_len) > fmw_size) {
+        ESP_LOGE(TAG, "Updated firmware size different from received.");
+        ota_checkpoint_clear();
+        return ERR_CODE_FAIL;
+    }
+
+    // Time spent waiting for the erase counts as write time
+    int64_t start_us = ota_metrics_start();
+    esp_err_t err = ota_erase_wait(written_fmw_size + data_len);
+    if (err == ESP_OK) {
+        err = OTA_SKIP_UNCHANGED ? ota_write_changed(data, data_len) : esp_ota_write(ota_handle, data, data_len);
+    }
+    ota_metrics_stop(OTA_METRICS_PHASE_WRITE, start_us);
+
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error writing OTA: %s", esp_err_to_name(err));
-        ota_in_progress = false;
-        updated_fmw_size = 0;
+        ota_checkpoint_clear();
         return ERR_CODE_FAIL;
     }
 
+    written_fmw_size += data_len;
+
+    return ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Adds a block already written by ota_process_write_block to the SHA-256 computation, persists the 
+ * progress at each checkpoint boundary and, after the last block, compares the image hash with the received one. 
+ * With CONFIG_MBEDTLS_HARDWARE_SHA the digest runs on the SHA peripheral. As with ota_process_write_block, 
+ * a failure leaves the update in progress until ota_process_end(false).
+ * 
+ * @param data Firmware block
+ * @param data_len Firmware block size
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS until the last block, then ERR_CODE_OK or ERR_CODE_FAIL
+ */
+types_error_code_e ota_process_verify_block(const uint8_t *data, const size_t data_len) {
+
+    if (!ota_in_progress) { 
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
     // Updates SHA256 computation with buffer data
+    int64_t start_us = ota_metrics_start();
     mbedtls_sha256_update(&sha_ctx, data, data_len);
+    ota_metrics_stop(OTA_METRICS_PHASE_SHA, start_us);
 
+    size_t prev_checkpoint = updated_fmw_size / OTA_CHECKPOINT_INTERVAL_BYTES;
     updated_fmw_size += data_len;
 
     if (updated_fmw_size < fmw_size) {
+        // Persist progress each time a checkpoint boundary is crossed
+        if ((updated_fmw_size / OTA_CHECKPOINT_INTERVAL_BYTES) != prev_checkpoint) {
+            ota_checkpoint_save();
+        }
         return ERR_CODE_IN_PROGRESS;
 
     } else if (updated_fmw_size > fmw_size) {
         ESP_LOGE(TAG, "Updated firmware size different from received.");
-        ota_in_progress = false;
-        updated_fmw_size = 0;
+        ota_checkpoint_clear();
         return ERR_CODE_FAIL;
 
     } else {
         uint8_t calc_hash[HASH_SIZE_IN_BYTES] = {0};
 
+        // The whole image was received, there is nothing left to resume
+        ota_checkpoint_clear();
+
         if (ota_process_compute_hash(calc_hash) != 0) {
             ESP_LOGE(TAG, "Failed to compute hash SHA-256");
-            ota_in_progress = false;
-            updated_fmw_size = 0;
             return ERR_CODE_FAIL;
         }
 
@@ -135,24 +397,65 @@ int ota_process_compute_hash(uint8_t *out_sha256) {
  */
 types_error_code_e ota_process_end(bool is_healthy) {
 
+    // Also stops an erase left running by a failed write or verification
+    ota_erase_stop();
+
+    // The only place an update is released, so failed writes and verifications are cleaned up here too
     if (!ota_in_progress) { 
         return ERR_CODE_NOT_ALLOWED;
     }
 
     ota_in_progress = false;
     updated_fmw_size = 0;
+    written_fmw_size = 0;
     // Free memory allocated for the context
     mbedtls_sha256_free(&sha_ctx);
 
     if (!is_healthy) {
+        // Keeps the checkpoint, so the interrupted update can be resumed
+        esp_ota_abort(ota_handle);
+        ota_hash_cache_resume();
         ESP_LOGE(TAG, "OTA update interrupted: system not healthy.");
         return ERR_CODE_FAIL;
     }
 
+    if (OTA_SKIP_UNCHANGED) {
+        ESP_LOGI(TAG, "%u of %u bytes already in the partition were not rewritten", 
+                 (unsigned int)skipped_fmw_size, (unsigned int)fmw_size);
+    }
+
     // Finish OTA update
-    ESP_ERROR_CHECK(esp_ota_end(ota_handle));
+    int64_t start_us = ota_metrics_start();
+    if (OTA_SKIP_UNCHANGED && (skipped_fmw_size == fmw_size)) {
+        // esp_ota_end refuses a handle nothing was written with, the image is still validated 
+        // by esp_ota_set_boot_partition
+        esp_ota_abort(ota_handle);
+    } else {
+        ESP_ERROR_CHECK(esp_ota_end(ota_handle));
+    }
+    ota_metrics_stop(OTA_METRICS_PHASE_OTA_END, start_us);
+
+#if OTA_READBACK_VERIFY
+    // What was received was hashed already, check what actually landed in flash
+    start_us = ota_metrics_start();
+    types_error_code_e verify_err = ota_readback_verify();
+    ota_metrics_stop(OTA_METRICS_PHASE_READBACK, start_us);
 
-    if (esp_ota_set_boot_partition(ota_partition) != ESP_OK) {
+    if (verify_err != ERR_CODE_OK) {
+        ESP_LOGE(TAG, "Flashed image does not match the received hash");
+        ota_hash_cache_resume();
+        return ERR_CODE_FAIL;
+    }
+#endif
+
+    // Also resumes the idle hashing of the other partitions
+    ota_hash_cache_store(ota_partition, fmw_size, sent_hash);
+
+    start_us = ota_metrics_start();
+    esp_err_t err = esp_ota_set_boot_partition(ota_partition);
+    ota_metrics_stop(OTA_METRICS_PHASE_SET_BOOT, start_us);
+
+    if (err != ESP_OK) {
         ESP_LOGE(TAG, "Error setting up new OTA partition");
         return ERR_CODE_FAIL;
     }
@@ -162,8 +465,8 @@ types_error_code_e ota_process_end(bool is_healthy) {
 
 /**
  * @brief Compares two hash values, recv_hash and calc_hash, byte by byte to verify their equality. 
- * If any mismatch is found, it logs an error, updates OTA-related state variables, and returns ERR_CODE_FAIL; 
- * otherwise, it returns ERR_CODE_OK.
+ * If any mismatch is found, it logs an error and returns ERR_CODE_FAIL, the update stays in progress until
+ * ota_process_end(false); otherwise, it returns ERR_CODE_OK.
  * 
  * @param recv_hash Received hash
  * @param calc_hash Calculated hash
@@ -174,8 +477,6 @@ static types_error_code_e ota_compare_hashes(const uint8_t *recv_hash, const uin
     for (int i = 0; i < HASH_SIZE_IN_BYTES; i++) {
         if (recv_hash[i] != calc_hash[i]) {
             ESP_LOGE(TAG, "Different hashes.");
-            ota_in_progress = false;
-            updated_fmw_size = 0;
             return ERR_CODE_FAIL;
         }
     }
@@ -183,6 +484,280 @@ static types_error_code_e ota_compare_hashes(const uint8_t *recv_hash, const uin
     return ERR_CODE_OK;
 }
 
+/**
+ * @brief Streams the written image back from the update partition through the flash cache, mapping 
+ * OTA_READBACK_CHUNK_BYTES at a time, and compares its SHA-256 with the received hash.
+ * 
+ * @return types_error_code_e 
+ */
+static types_error_code_e ota_readback_verify(void) {
+
+    mbedtls_sha256_context readback_ctx;
+    uint8_t calc_hash[HASH_SIZE_IN_BYTES] = {0};
+    int ret = 0;
+
+    mbedtls_sha256_init(&readback_ctx);
+    mbedtls_sha256_starts(&readback_ctx, 0);
+
+    for (size_t offset = 0; (offset < fmw_size) && (ret == 0); offset += OTA_READBACK_CHUNK_BYTES) {
+        size_t len = MIN(fmw_size - offset, OTA_READBACK_CHUNK_BYTES);
+        const void *p_mapped = NULL;
+        esp_partition_mmap_handle_t mmap_handle = 0;
+
+        if (esp_partition_mmap(ota_partition, offset, len, ESP_PARTITION_MMAP_DATA, &p_mapped, &mmap_handle) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to map the update partition at offset %u", (unsigned int)offset);
+            ret = -1;
+            break;
+        }
+
+        ret = mbedtls_sha256_update(&readback_ctx, p_mapped, len);
+        esp_partition_munmap(mmap_handle);
+    }
+
+    if (ret == 0) {
+        ret = mbedtls_sha256_finish(&readback_ctx, calc_hash);
+    }
+
+    mbedtls_sha256_free(&readback_ctx);
+
+    return ((ret == 0) && (memcmp(calc_hash, sent_hash, HASH_SIZE_IN_BYTES) == 0)) ? ERR_CODE_OK : ERR_CODE_FAIL;
+}
+
+/**
+ * @brief Writes a block at the write cursor sector by sector, comparing each part with what the update 
+ * partition holds through the flash cache first. Unchanged parts are neither erased nor programmed, the 
+ * others are programmed into a sector erased on the way. ota_writer hands whole sectors, so a sector only 
+ * spans two blocks when a resumed or final block is not sector aligned, its kept head is then rewritten.
+ * 
+ * @param data Firmware block
+ * @param data_len Firmware block size
+ * @return esp_err_t 
+ */
+static esp_err_t ota_write_changed(const uint8_t *data, const size_t data_len) {
+
+    esp_err_t err = ESP_OK;
+
+    for (size_t done = 0; (done < data_len) && (err == ESP_OK);) {
+        size_t offset = written_fmw_size + done;
+        size_t sector_start = offset - (offset % SPI_FLASH_SEC_SIZE);
+        size_t len = MIN(data_len - done, sector_start + SPI_FLASH_SEC_SIZE - offset);
+
+        if (sector_start >= erased_fmw_size) {
+            const void *p_mapped = NULL;
+            esp_partition_mmap_handle_t mmap_handle = 0;
+
+            err = esp_partition_mmap(ota_partition, offset, len, ESP_PARTITION_MMAP_DATA, &p_mapped, &mmap_handle);
+            if (err != ESP_OK) {
+                break;
+            }
+
+            bool is_unchanged = (memcmp(p_mapped, data + done, len) == 0);
+            esp_partition_munmap(mmap_handle);
+
+            if (is_unchanged) {
+                skipped_fmw_size += len;
+                done += len;
+                continue;
+            }
+
+            // The head of the sector was kept unchanged, it is read back to survive the erase
+            uint8_t *p_head = NULL;
+            size_t head_len = offset - sector_start;
+            if (head_len > 0) {
+                p_head = malloc(head_len);
+                err = (p_head != NULL) ? esp_partition_read(ota_partition, sector_start, p_head, head_len) : ESP_ERR_NO_MEM;
+            }
+
+            if (err == ESP_OK) {
+                err = esp_partition_erase_range(ota_partition, sector_start, SPI_FLASH_SEC_SIZE);
+            }
+            if ((err == ESP_OK) && (head_len > 0)) {
+                err = esp_ota_write_with_offset(ota_handle, p_head, head_len, sector_start);
+                skipped_fmw_size -= head_len;
+            }
+            free(p_head);
+
+            erased_fmw_size = sector_start + SPI_FLASH_SEC_SIZE;
+        }
+
+        if (err == ESP_OK) {
+            err = esp_ota_write_with_offset(ota_handle, data + done, len, offset);
+        }
+        done += len;
+    }
+
+    return err;
+}
+
+/**
+ * @brief Reads the update checkpoint from NVS.
+ * 
+ * @param checkpoint Output parameter of checkpoint
+ * @return true when a checkpoint written by this firmware was found
+ */
+static bool ota_checkpoint_load(ota_checkpoint_t *checkpoint) {
+
+    nvs_handle_t nvs_handle = 0;
+    if (nvs_open(CHECKPOINT_NVS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK) {
+        return false;
+    }
+
+    size_t len = sizeof(ota_checkpoint_t);
+    esp_err_t err = nvs_get_blob(nvs_handle, CHECKPOINT_NVS_KEY, checkpoint, &len);
+    nvs_close(nvs_handle);
+
+    return ((err == ESP_OK) && (len == sizeof(ota_checkpoint_t)));
+}
+
+/**
+ * @brief Persists the current update progress in NVS. It runs right after a block was written, 
+ * so the offset only covers bytes that are already in flash.
+ */
+static void ota_checkpoint_save(void) {
+
+    ota_checkpoint_t checkpoint = {
+        .partition_address = ota_partition->address,
+        .img_size = fmw_size,
+        .offset = updated_fmw_size
+    };
+    memcpy(checkpoint.hash, sent_hash, HASH_SIZE_IN_BYTES);
+
+    // Clone moves a hardware-backed digest state into the context itself
+    mbedtls_sha256_init(&checkpoint.sha_ctx);
+    mbedtls_sha256_clone(&checkpoint.sha_ctx, &sha_ctx);
+
+    nvs_handle_t nvs_handle = 0;
+    esp_err_t err = nvs_open(CHECKPOINT_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs_handle, CHECKPOINT_NVS_KEY, &checkpoint, sizeof(checkpoint));
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+
+    mbedtls_sha256_free(&checkpoint.sha_ctx);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to save OTA checkpoint: %s", esp_err_to_name(err));
+    }
+}
+
+/**
+ * @brief Removes the update checkpoint from NVS.
+ */
+static void ota_checkpoint_clear(void) {
+
+    nvs_handle_t nvs_handle = 0;
+    if (nvs_open(CHECKPOINT_NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) {
+        return;
+    }
+
+    if (nvs_erase_key(nvs_handle, CHECKPOINT_NVS_KEY) == ESP_OK) {
+        nvs_commit(nvs_handle);
+    }
+
+    nvs_close(nvs_handle);
+}
+
+/**
+ * @brief Starts erasing the image range from a background task, one chunk at a time. The task runs below 
+ * the writer, so the erase mostly happens while the writer waits for data from the network.
+ * 
+ * @param partition Update partition
+ * @param from Offset to erase from, multiple of the sector size
+ * @param img_size Firmware size to be updated
+ * @return esp_err_t
+ */
+static esp_err_t ota_erase_start(const esp_partition_t *partition, const size_t from, const size_t img_size) {
+
+    if (eraser.progress == NULL) {
+        eraser.progress = xSemaphoreCreateBinary();
+        if (eraser.progress == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    eraser.partition = partition;
+    eraser.end = MIN((img_size + partition->erase_size - 1U) / partition->erase_size * partition->erase_size,
+                     partition->size);
+    eraser.watermark = from;
+    eraser.stop = false;
+    eraser.is_running = true;
+
+    if (xTaskCreatePinnedToCore(ota_erase_task, "ota_erase_task", ERASE_TASK_STACK_SIZE, NULL,
+                                ERASE_TASK_PRIORITY, NULL, ERASE_PINNED_CORE) != pdPASS) {
+        eraser.is_running = false;
+        eraser.end = 0;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Blocks until the image range up to end is erased
+ * 
+ * @param end Image offset the next write reaches
+ * @return esp_err_t ESP_FAIL when the erase stopped before end
+ */
+static esp_err_t ota_erase_wait(const size_t end) {
+
+    size_t target = MIN(end, eraser.end);
+
+    while (eraser.watermark < target) {
+        if (!eraser.is_running) {
+            ESP_LOGE(TAG, "Erase stopped at %u", (unsigned int)eraser.watermark);
+            return ESP_FAIL;
+        }
+        xSemaphoreTake(eraser.progress, portMAX_DELAY);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Stops the background erase and waits for the task to exit, the chunk being erased is completed
+ */
+static void ota_erase_stop(void) {
+
+    eraser.stop = true;
+
+    while (eraser.is_running) {
+        xSemaphoreTake(eraser.progress, portMAX_DELAY);
+    }
+
+    eraser.end = 0;
+}
+
+/**
+ * @brief Background erase task, exits once the image range is erased, on error or when stopped
+ * 
+ * @param params Task parameters
+ */
+static void ota_erase_task(void *params) {
+
+    while (!eraser.stop && (eraser.watermark < eraser.end)) {
+        // Chunks are aligned, so whole blocks go through the block erase
+        size_t len = MIN(OTA_ERASE_CHUNK_BYTES - (eraser.watermark % OTA_ERASE_CHUNK_BYTES),
+                         eraser.end - eraser.watermark);
+
+        esp_err_t err = esp_partition_erase_range(eraser.partition, eraser.watermark, len);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error erasing the OTA partition: %s", esp_err_to_name(err));
+            break;
+        }
+
+        eraser.watermark += len;
+        xSemaphoreGive(eraser.progress);
+    }
+
+    eraser.is_running = false;
+    xSemaphoreGive(eraser.progress);
+
+    vTaskDelete(NULL);
+}
+
 /**
  * @brief Evaluates the health of the system and manages OTA rollback behavior based on the firmware state. 
  * If the system is unhealthy or the firmware verification fails, it triggers a rollback and reboot; 
@@ -0,0 +1,30 @@
+#ifndef OTA_MANIFEST_H
+#define OTA_MANIFEST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+
+#define OTA_MANIFEST_KEY_MAX_LEN            (512U) /* DER or NUL terminated PEM ECDSA P-256 public key */
+
+#define OTA_MANIFEST_VERSION                (1U)
+#define OTA_MANIFEST_TARGET_LEN             (32U)  /* Project name of the firmware, as in esp_app_desc_t */
+#define OTA_MANIFEST_HASH_LEN               (32U)
+#define OTA_MANIFEST_SIGNED_LEN             (1U + OTA_MANIFEST_TARGET_LEN + 4U + OTA_MANIFEST_HASH_LEN)
+#define OTA_MANIFEST_SIGNATURE_MAX_LEN      (72U)  /* DER encoded ECDSA P-256 signature */
+#define OTA_MANIFEST_MAX_LEN                (OTA_MANIFEST_SIGNED_LEN + 1U + OTA_MANIFEST_SIGNATURE_MAX_LEN)
+
+
+types_error_code_e ota_manifest_set_public_key(const uint8_t * p_key, const size_t len);
+
+bool ota_manifest_is_required(void);
+
+types_error_code_e ota_manifest_verify(const uint8_t * p_manifest,
+                                       const size_t len,
+                                       uint32_t * p_out_image_size,
+                                       uint8_t * p_out_hash);
+
+#endif
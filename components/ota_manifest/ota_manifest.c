@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_app_desc.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/sha256.h"
+#include "ota_manifest.h"
+
+/* ----------------- MANIFEST -----------------
+ * version (1) | target (32) | image size (4) | image hash (32) | signature length (1) | signature
+ * The signature is an ECDSA P-256 signature over the SHA-256 of the fields before the signature
+ * length, DER encoded. The image size is little endian and the target is the project name,
+ * NUL padded, so an image built for another product is refused.
+ */
+#define TARGET_OFFSET                       (1U)
+#define IMAGE_SIZE_OFFSET                   (TARGET_OFFSET + OTA_MANIFEST_TARGET_LEN)
+#define HASH_OFFSET                         (IMAGE_SIZE_OFFSET + 4U)
+#define SIGNATURE_LEN_OFFSET                (OTA_MANIFEST_SIGNED_LEN)
+#define SIGNATURE_OFFSET                    (SIGNATURE_LEN_OFFSET + 1U)
+
+
+static const char *tag = "OTA_MANIFEST";
+
+static struct {
+    mbedtls_pk_context ctx;
+    bool is_set;
+} public_key = { .is_set = false };
+
+/**
+ * @brief Public key setter. Once set, every update must carry a manifest signed with the matching private key
+ *
+ * @param p_key [in]: ECDSA P-256 public key, DER or NUL terminated PEM
+ * @param len [in]: Public key length in bytes
+ * @return types_error_code_e
+ */
+types_error_code_e ota_manifest_set_public_key(const uint8_t * p_key, const size_t len)
+{
+    if (public_key.is_set == true)
+    {
+        ESP_LOGE(tag, "----- Public key already set -----");
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if ((len == 0) || (len > OTA_MANIFEST_KEY_MAX_LEN))
+    {
+        ESP_LOGE(tag, "----- Public key invalid range -----");
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    mbedtls_pk_init(&public_key.ctx);
+
+    if ((mbedtls_pk_parse_public_key(&public_key.ctx, p_key, len) != 0) ||
+        !mbedtls_pk_can_do(&public_key.ctx, MBEDTLS_PK_ECDSA))
+    {
+        ESP_LOGE(tag, "----- Invalid public key -----");
+        mbedtls_pk_free(&public_key.ctx);
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    public_key.is_set = true;
+    ESP_LOGI(tag, "----- Public key has set -----");
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Check whether updates must be signed
+ *
+ * @return true when a public key was provisioned
+ */
+bool ota_manifest_is_required(void)
+{
+    return public_key.is_set;
+}
+
+/**
+ * @brief Verify a manifest signature and target, then externalize the image it describes
+ *
+ * @param p_manifest [in]: Manifest buffer
+ * @param len [in]: Manifest length in bytes
+ * @param p_out_image_size [out]: Signed image size
+ * @param p_out_hash [out]: Signed image SHA-256, OTA_MANIFEST_HASH_LEN bytes
+ * @return types_error_code_e
+ */
+types_error_code_e ota_manifest_verify(const uint8_t * p_manifest,
+                                       const size_t len,
+                                       uint32_t * p_out_image_size,
+                                       uint8_t * p_out_hash)
+{
+    if (!public_key.is_set)
+    {
+        return ERR_CODE_NOT_ALLOWED;
+    }
+
+    if ((len < SIGNATURE_OFFSET) ||
+        (p_manifest[0] != OTA_MANIFEST_VERSION) ||
+        (p_manifest[SIGNATURE_LEN_OFFSET] > OTA_MANIFEST_SIGNATURE_MAX_LEN) ||
+        (len != (SIGNATURE_OFFSET + p_manifest[SIGNATURE_LEN_OFFSET])))
+    {
+        ESP_LOGW(tag, "----- Malformed manifest -----");
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    char target[OTA_MANIFEST_TARGET_LEN] = {};
+    strncpy(target, esp_app_get_description()->project_name, sizeof(target) - 1U);
+
+    if (memcmp(p_manifest + TARGET_OFFSET, target, sizeof(target)) != 0)
+    {
+        ESP_LOGW(tag, "----- Manifest built for another target -----");
+        return ERR_CODE_FAIL;
+    }
+
+    uint8_t digest[OTA_MANIFEST_HASH_LEN] = {};
+    if ((mbedtls_sha256(p_manifest, OTA_MANIFEST_SIGNED_LEN, digest, 0) != 0) ||
+        (mbedtls_pk_verify(&public_key.ctx, MBEDTLS_MD_SHA256, digest, sizeof(digest),
+                           p_manifest + SIGNATURE_OFFSET, p_manifest[SIGNATURE_LEN_OFFSET]) != 0))
+    {
+        ESP_LOGW(tag, "----- Invalid manifest signature -----");
+        return ERR_CODE_FAIL;
+    }
+
+    *p_out_image_size = 0;
+    for (uint8_t i = 0; i < 4U; i++)
+    {
+        *p_out_image_size |= ((uint32_t)p_manifest[IMAGE_SIZE_OFFSET + i]) << (8U * i);
+    }
+
+    memcpy(p_out_hash, p_manifest + HASH_OFFSET, OTA_MANIFEST_HASH_LEN);
+
+    ESP_LOGI(tag, "----- Manifest successfully verified -----");
+
+    return ERR_CODE_OK;
+}
@@ -0,0 +1,49 @@
+#ifndef OTA_METRICS_H
+#define OTA_METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "types.h"
+
+
+#define OTA_METRICS_WRITE_HIST_BUCKETS      (8U)
+
+/* state (1) | image size (4) | duration (4) | min free heap (4) | per phase: total (4), count (4), max (4) | buckets */
+#define OTA_METRICS_SUMMARY_LEN_BYTES       (13U + (OTA_METRICS_PHASE_COUNT * 12U) + (OTA_METRICS_WRITE_HIST_BUCKETS * 4U))
+
+
+typedef enum {
+    OTA_METRICS_PHASE_HANDSHAKE,    /* TLS server handshake */
+    OTA_METRICS_PHASE_HMAC,         /* Nonce challenge and response check */
+    OTA_METRICS_PHASE_HEADER,       /* Header parse and negotiation */
+    OTA_METRICS_PHASE_OTA_BEGIN,    /* esp_ota_begin, including the partition erase */
+    OTA_METRICS_PHASE_WRITE,        /* Each esp_ota_write */
+    OTA_METRICS_PHASE_SHA,          /* Each SHA-256 update */
+    OTA_METRICS_PHASE_OTA_END,      /* esp_ota_end, including the image validation */
+    OTA_METRICS_PHASE_SET_BOOT,     /* esp_ota_set_boot_partition */
+    OTA_METRICS_PHASE_READBACK,     /* Hash of the image read back from flash */
+    OTA_METRICS_PHASE_COUNT
+} ota_metrics_phase_e;
+
+typedef enum {
+    OTA_METRICS_STATE_NONE,
+    OTA_METRICS_STATE_IN_PROGRESS,
+    OTA_METRICS_STATE_DONE,
+    OTA_METRICS_STATE_FAILED
+} ota_metrics_state_e;
+
+
+types_error_code_e ota_metrics_init(void);
+
+int64_t ota_metrics_start(void);
+
+void ota_metrics_stop(const ota_metrics_phase_e phase, const int64_t start_us);
+
+void ota_metrics_begin_update(const uint32_t image_size);
+
+void ota_metrics_end_update(const bool is_ok);
+
+types_error_code_e ota_metrics_build_summary(uint8_t * p_buffer, const uint8_t len, uint8_t * p_out_len);
+
+#endif
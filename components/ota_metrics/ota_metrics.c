@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "ota_metrics.h"
+
+
+#define METRICS_MAGIC               (0x4D41544FUL) /* Tells a kept summary from RTC memory garbage after power on */
+
+
+typedef struct {
+    uint32_t total_us;
+    uint32_t count;
+    uint32_t max_us;
+} ota_metrics_phase_t;
+
+/**
+ * @brief Timings of the last update. It lives in RTC memory that is not initialized on a software reset,
+ * so the summary of a successful update is still readable after the restart that applies it.
+ */
+typedef struct {
+    uint32_t magic;
+    uint8_t state;
+    uint32_t image_size;
+    int64_t start_us;
+    uint32_t duration_us;
+    uint32_t min_free_heap;
+    ota_metrics_phase_t phases[OTA_METRICS_PHASE_COUNT];
+    uint32_t write_hist[OTA_METRICS_WRITE_HIST_BUCKETS];
+} ota_metrics_summary_t;
+
+
+static const char *tag = "OTA_METRICS";
+
+/* Upper bound of each esp_ota_write latency bucket, the last bucket takes everything above */
+static const uint32_t write_hist_limits_us[OTA_METRICS_WRITE_HIST_BUCKETS - 1U] = {
+    250U, 500U, 1000U, 2000U, 5000U, 10000U, 50000U
+};
+
+static RTC_NOINIT_ATTR ota_metrics_summary_t summary;
+
+/* Handshake and HMAC happen before the header tells an update is coming, they are moved into the summary then */
+static ota_metrics_phase_t connection_phases[OTA_METRICS_PHASE_HEADER] = {};
+
+static SemaphoreHandle_t semaphore = NULL;
+
+/* ------------------- Private Functions ------------------- */
+
+static void record(ota_metrics_phase_t * p_phase, const uint32_t elapsed_us);
+static uint8_t *put_u32_le(uint8_t * p_data, const uint32_t value);
+
+/* --------------------------------------------------------- */
+
+/**
+ * @brief Initialize the ota_metrics component, keeping the summary left by the previous boot when valid
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_metrics_init(void)
+{
+    semaphore = xSemaphoreCreateMutex();
+    if (semaphore == NULL)
+    {
+        ESP_LOGE(tag, "----- Failed to create metrics mutex -----");
+        return ERR_CODE_FAIL;
+    }
+
+    if ((summary.magic != METRICS_MAGIC) || (summary.state > OTA_METRICS_STATE_FAILED))
+    {
+        memset(&summary, 0, sizeof(summary));
+        summary.magic = METRICS_MAGIC;
+    }
+    else if (summary.state == OTA_METRICS_STATE_IN_PROGRESS)
+    {
+        /* Reset in the middle of an update */
+        summary.state = OTA_METRICS_STATE_FAILED;
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Timestamp the start of a phase
+ *
+ * @return int64_t Start time in microseconds, to be handed to ota_metrics_stop
+ */
+int64_t ota_metrics_start(void)
+{
+    return esp_timer_get_time();
+}
+
+/**
+ * @brief Account the time elapsed since start_us to a phase. Handshake and HMAC are staged until the next
+ * update begins, the other phases are added to the running update
+ *
+ * @param phase [in]: Measured phase
+ * @param start_us [in]: Value returned by ota_metrics_start
+ */
+void ota_metrics_stop(const ota_metrics_phase_e phase, const int64_t start_us)
+{
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+
+    if ((semaphore == NULL) || (phase >= OTA_METRICS_PHASE_COUNT))
+    {
+        return;
+    }
+
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+
+    if (phase < OTA_METRICS_PHASE_HEADER)
+    {
+        /* A handshake opens a new connection, timings of a previous one that sent no update are dropped */
+        if (phase == OTA_METRICS_PHASE_HANDSHAKE)
+        {
+            memset(connection_phases, 0, sizeof(connection_phases));
+        }
+
+        record(&connection_phases[phase], elapsed_us);
+    }
+    else if (summary.state == OTA_METRICS_STATE_IN_PROGRESS)
+    {
+        record(&summary.phases[phase], elapsed_us);
+
+        if (phase == OTA_METRICS_PHASE_WRITE)
+        {
+            uint8_t bucket = 0;
+            while ((bucket < (OTA_METRICS_WRITE_HIST_BUCKETS - 1U)) && (elapsed_us >= write_hist_limits_us[bucket]))
+            {
+                bucket++;
+            }
+
+            summary.write_hist[bucket]++;
+        }
+    }
+
+    xSemaphoreGive(semaphore);
+}
+
+/**
+ * @brief Start a new summary, replacing the one of the previous update
+ *
+ * @param image_size [in]: Announced firmware size
+ */
+void ota_metrics_begin_update(const uint32_t image_size)
+{
+    if (semaphore == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+
+    memset(&summary, 0, sizeof(summary));
+    summary.magic = METRICS_MAGIC;
+    summary.state = OTA_METRICS_STATE_IN_PROGRESS;
+    summary.image_size = image_size;
+    summary.start_us = esp_timer_get_time();
+
+    memcpy(summary.phases, connection_phases, sizeof(connection_phases));
+    memset(connection_phases, 0, sizeof(connection_phases));
+
+    xSemaphoreGive(semaphore);
+}
+
+/**
+ * @brief Close the running summary and log it
+ *
+ * @param is_ok [in]: True when the new image was set as boot partition
+ */
+void ota_metrics_end_update(const bool is_ok)
+{
+    if (semaphore == NULL)
+    {
+        return;
+    }
+
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+
+    if (summary.state != OTA_METRICS_STATE_IN_PROGRESS)
+    {
+        xSemaphoreGive(semaphore);
+        return;
+    }
+
+    summary.state = is_ok ? OTA_METRICS_STATE_DONE : OTA_METRICS_STATE_FAILED;
+    summary.duration_us = (uint32_t)(esp_timer_get_time() - summary.start_us);
+    summary.min_free_heap = esp_get_minimum_free_heap_size();
+
+    const ota_metrics_phase_t *p_write = &summary.phases[OTA_METRICS_PHASE_WRITE];
+
+    ESP_LOGI(tag, "----- Update %s: %u bytes in %u ms, write %u ms (max %u us), sha %u ms, end %u ms -----",
+             is_ok ? "done" : "failed",
+             (unsigned int)summary.image_size,
+             (unsigned int)(summary.duration_us / 1000U),
+             (unsigned int)(p_write->total_us / 1000U),
+             (unsigned int)p_write->max_us,
+             (unsigned int)(summary.phases[OTA_METRICS_PHASE_SHA].total_us / 1000U),
+             (unsigned int)(summary.phases[OTA_METRICS_PHASE_OTA_END].total_us / 1000U));
+
+    xSemaphoreGive(semaphore);
+}
+
+/**
+ * @brief Serialize the summary of the last update, little endian
+ * Layout: state (1) | image size (4) | duration us (4) | min free heap (4) |
+ *         per phase: total us (4) | count (4) | max us (4) | write latency buckets (4 each)
+ *
+ * @param p_buffer [out]: Summary buffer
+ * @param len [in]: Summary buffer length
+ * @param p_out_len [out]: Serialized summary length
+ * @return types_error_code_e
+ */
+types_error_code_e ota_metrics_build_summary(uint8_t * p_buffer, const uint8_t len, uint8_t * p_out_len)
+{
+    if ((semaphore == NULL) || (len < OTA_METRICS_SUMMARY_LEN_BYTES))
+    {
+        return ERR_CODE_INVALID_PARAM;
+    }
+
+    xSemaphoreTake(semaphore, portMAX_DELAY);
+
+    uint8_t *p_data = p_buffer;
+
+    *p_data++ = summary.state;
+    p_data = put_u32_le(p_data, summary.image_size);
+    p_data = put_u32_le(p_data, summary.duration_us);
+    p_data = put_u32_le(p_data, summary.min_free_heap);
+
+    for (uint8_t i = 0; i < OTA_METRICS_PHASE_COUNT; i++)
+    {
+        p_data = put_u32_le(p_data, summary.phases[i].total_us);
+        p_data = put_u32_le(p_data, summary.phases[i].count);
+        p_data = put_u32_le(p_data, summary.phases[i].max_us);
+    }
+
+    for (uint8_t i = 0; i < OTA_METRICS_WRITE_HIST_BUCKETS; i++)
+    {
+        p_data = put_u32_le(p_data, summary.write_hist[i]);
+    }
+
+    xSemaphoreGive(semaphore);
+
+    *p_out_len = OTA_METRICS_SUMMARY_LEN_BYTES;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Add one measure to a phase
+ *
+ * @param p_phase [in]: Phase accumulator
+ * @param elapsed_us [in]: Measured time
+ */
+static void record(ota_metrics_phase_t * p_phase, const uint32_t elapsed_us)
+{
+    p_phase->total_us += elapsed_us;
+    p_phase->count++;
+
+    if (elapsed_us > p_phase->max_us)
+    {
+        p_phase->max_us = elapsed_us;
+    }
+}
+
+/**
+ * @brief Write a little endian 32 bits value
+ *
+ * @param p_data [out]: Data buffer
+ * @param value [in]: Value to be written
+ * @return uint8_t* First byte after the value
+ */
+static uint8_t *put_u32_le(uint8_t * p_data, const uint32_t value)
+{
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        p_data[i] = (value >> (8U * i)) & 0xFF;
+    }
+
+    return p_data + sizeof(value);
+}
@@ -0,0 +1,35 @@
+#ifndef OTA_WRITER_H
+#define OTA_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "types.h"
+
+
+#define OTA_WRITER_BLOCK_LEN_BYTES      (4096U) /* One flash sector per block */
+#define OTA_WRITER_BLOCK_COUNT          (4U) /* One being filled, flashed and hashed, plus one of slack */
+
+
+/**
+ * @brief Called from the writer or hash task when a block fails, must not block
+ */
+typedef void (*ota_writer_fault_cb_t)(void);
+
+types_error_code_e ota_writer_init(void);
+
+void ota_writer_set_fault_cb(ota_writer_fault_cb_t fault_cb);
+
+void ota_writer_start(void);
+
+types_error_code_e ota_writer_get_fill_buffer(uint8_t ** pp_buffer, size_t * p_len);
+
+types_error_code_e ota_writer_push(const uint8_t * p_data, const size_t len);
+
+types_error_code_e ota_writer_get_status(void);
+
+types_error_code_e ota_writer_finish(void);
+
+void ota_writer_abort(void);
+
+#endif
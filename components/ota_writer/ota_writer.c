@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "ota_manager.h"
+#include "ota_writer.h"
+
+
+#define PINNED_CORE                 (0) /* tcp_tls runs on core 1, flash writes run on the other one */
+#define WRITER_TASK_STACK_SIZE      (4096U)
+#define WRITER_TASK_PRIORITY        (4U)
+
+#define HASH_PINNED_CORE            (1) /* Hashing overlaps the flash writes of the next block */
+#define HASH_TASK_STACK_SIZE        (4096U)
+#define HASH_TASK_PRIORITY          (4U)
+
+#define FLUSH_REQUEST               (0xFFU)
+
+
+typedef struct {
+    uint8_t data[OTA_WRITER_BLOCK_LEN_BYTES];
+    size_t len;
+} ota_writer_block_t;
+
+
+static const char *tag = "OTA_WRITER";
+
+static ota_writer_block_t blocks[OTA_WRITER_BLOCK_COUNT] = {};
+
+static QueueHandle_t free_queue = NULL;         /* Indexes of empty blocks */
+static QueueHandle_t filled_queue = NULL;       /* Indexes of blocks ready to be flashed */
+static QueueHandle_t flashed_queue = NULL;      /* Indexes of blocks flashed and ready to be hashed */
+static SemaphoreHandle_t flush_semaphore = NULL;
+
+static volatile types_error_code_e write_status = ERR_CODE_NOT_ALLOWED;
+static uint8_t fill_index = FLUSH_REQUEST;      /* Block being filled by the producer */
+static ota_writer_fault_cb_t fault_callback = NULL;
+
+/* ------------------- Private Functions ------------------- */
+
+static void ota_writer_task(void * params);
+static void ota_hash_task(void * params);
+static void submit_fill_block(void);
+static void wait_idle(void);
+static void report_fault(const types_error_code_e status);
+
+/* --------------------------------------------------------- */
+
+/**
+ * @brief Initialize the ota_writer component
+ *
+ * @return types_error_code_e
+ */
+types_error_code_e ota_writer_init(void)
+{
+    free_queue = xQueueCreate(OTA_WRITER_BLOCK_COUNT, sizeof(uint8_t));
+    filled_queue = xQueueCreate(OTA_WRITER_BLOCK_COUNT + 1U, sizeof(uint8_t));
+    flashed_queue = xQueueCreate(OTA_WRITER_BLOCK_COUNT + 1U, sizeof(uint8_t));
+    flush_semaphore = xSemaphoreCreateBinary();
+
+    if ((free_queue == NULL) || (filled_queue == NULL) || (flashed_queue == NULL) || (flush_semaphore == NULL))
+    {
+        ESP_LOGE(tag, "----- Failed to create writer queues -----");
+        return ERR_CODE_FAIL;
+    }
+
+    for (uint8_t i = 0; i < OTA_WRITER_BLOCK_COUNT; i++)
+    {
+        xQueueSend(free_queue, &i, 0);
+    }
+
+    BaseType_t result = xTaskCreatePinnedToCore(ota_writer_task, "ota_writer_task", WRITER_TASK_STACK_SIZE,
+                                                NULL, WRITER_TASK_PRIORITY, NULL, PINNED_CORE);
+    if (result != pdPASS)
+    {
+        ESP_LOGE(tag, "----- Failed to create writer task -----");
+        return ERR_CODE_FAIL;
+    }
+
+    result = xTaskCreatePinnedToCore(ota_hash_task, "ota_hash_task", HASH_TASK_STACK_SIZE,
+                                     NULL, HASH_TASK_PRIORITY, NULL, HASH_PINNED_CORE);
+    if (result != pdPASS)
+    {
+        ESP_LOGE(tag, "----- Failed to create hash task -----");
+        return ERR_CODE_FAIL;
+    }
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Register the callback told about blocks failing in the background, so the producer can end the
+ * update without waiting for its next push
+ *
+ * @param fault_cb [in]: Fault callback, NULL to remove it
+ */
+void ota_writer_set_fault_cb(ota_writer_fault_cb_t fault_cb)
+{
+    fault_callback = fault_cb;
+}
+
+/**
+ * @brief Arm the writer for a new update. Must be called after ota_process_init
+ *
+ */
+void ota_writer_start(void)
+{
+    fill_index = FLUSH_REQUEST;
+    write_status = ERR_CODE_IN_PROGRESS;
+}
+
+/**
+ * @brief Lend the free space of the block being filled, so firmware data can be received straight into it.
+ * The data is accounted by handing the same pointer to ota_writer_push, which then skips the copy
+ *
+ * @param pp_buffer [out]: Free space of the block being filled
+ * @param p_len [out]: Free space length
+ * @return types_error_code_e ERR_CODE_FAIL if a previous block could not be written or verified
+ */
+types_error_code_e ota_writer_get_fill_buffer(uint8_t ** pp_buffer, size_t * p_len)
+{
+    if (write_status != ERR_CODE_IN_PROGRESS)
+    {
+        return ERR_CODE_FAIL;
+    }
+
+    if (fill_index == FLUSH_REQUEST)
+    {
+        xQueueReceive(free_queue, &fill_index, portMAX_DELAY);
+    }
+
+    ota_writer_block_t *p_block = &blocks[fill_index];
+
+    *pp_buffer = p_block->data + p_block->len;
+    *p_len = OTA_WRITER_BLOCK_LEN_BYTES - p_block->len;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Copy firmware data into the block ring. Full blocks are handed to the writer task,
+ * so the caller only blocks when every block is waiting to be flashed
+ *
+ * @param p_data [in]: Firmware data buffer
+ * @param len [in]: Firmware data buffer length
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the update is healthy,
+ * ERR_CODE_FAIL if a previous block could not be written or verified
+ */
+types_error_code_e ota_writer_push(const uint8_t * p_data, const size_t len)
+{
+    size_t offset = 0;
+
+    while ((offset < len) && (write_status == ERR_CODE_IN_PROGRESS))
+    {
+        if (fill_index == FLUSH_REQUEST)
+        {
+            xQueueReceive(free_queue, &fill_index, portMAX_DELAY);
+        }
+
+        ota_writer_block_t *p_block = &blocks[fill_index];
+        size_t chunk_len = MIN(len - offset, OTA_WRITER_BLOCK_LEN_BYTES - p_block->len);
+
+        /* Data received in place with ota_writer_get_fill_buffer is already there */
+        if ((p_data + offset) != (p_block->data + p_block->len))
+        {
+            memcpy(p_block->data + p_block->len, p_data + offset, chunk_len);
+        }
+
+        p_block->len += chunk_len;
+        offset += chunk_len;
+
+        if (p_block->len == OTA_WRITER_BLOCK_LEN_BYTES)
+        {
+            submit_fill_block();
+        }
+    }
+
+    return ota_writer_get_status();
+}
+
+/**
+ * @brief Health of the blocks handed over so far, without pushing anything
+ *
+ * @return types_error_code_e ERR_CODE_IN_PROGRESS while the update is healthy,
+ * ERR_CODE_FAIL if a previous block could not be written or verified
+ */
+types_error_code_e ota_writer_get_status(void)
+{
+    types_error_code_e status = write_status;
+
+    return ((status == ERR_CODE_IN_PROGRESS) || (status == ERR_CODE_OK)) ? ERR_CODE_IN_PROGRESS : ERR_CODE_FAIL;
+}
+
+/**
+ * @brief Flush the partial block and wait until every block is written
+ *
+ * @return types_error_code_e Result of the last ota_process_verify_block (ERR_CODE_OK or ERR_CODE_FAIL)
+ */
+types_error_code_e ota_writer_finish(void)
+{
+    submit_fill_block();
+    wait_idle();
+
+    types_error_code_e status = (write_status == ERR_CODE_OK) ? ERR_CODE_OK : ERR_CODE_FAIL;
+    write_status = ERR_CODE_NOT_ALLOWED;
+
+    return status;
+}
+
+/**
+ * @brief Drop the partial block and wait until the blocks already queued are handled
+ *
+ */
+void ota_writer_abort(void)
+{
+    if (fill_index != FLUSH_REQUEST)
+    {
+        blocks[fill_index].len = 0;
+        xQueueSend(free_queue, &fill_index, portMAX_DELAY);
+        fill_index = FLUSH_REQUEST;
+    }
+
+    wait_idle();
+
+    write_status = ERR_CODE_NOT_ALLOWED;
+}
+
+/**
+ * @brief Writer task, flashes the filled blocks in order and hands them to the hash task
+ *
+ * @param params [in]: Task parameters
+ */
+static void ota_writer_task(void * params)
+{
+    uint8_t index = 0;
+
+    while (1)
+    {
+        xQueueReceive(filled_queue, &index, portMAX_DELAY);
+
+        /* Blocks after a failure or after the last one are discarded */
+        if ((index != FLUSH_REQUEST) && (write_status == ERR_CODE_IN_PROGRESS) &&
+            (ota_process_write_block(blocks[index].data, blocks[index].len) != ERR_CODE_IN_PROGRESS))
+        {
+            write_status = ERR_CODE_FAIL;
+            report_fault(ERR_CODE_FAIL);
+        }
+
+        /* Flush requests follow the blocks, so they complete once everything was hashed */
+        xQueueSend(flashed_queue, &index, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief Hash task, verifies the flashed blocks in order and releases them
+ *
+ * @param params [in]: Task parameters
+ */
+static void ota_hash_task(void * params)
+{
+    uint8_t index = 0;
+
+    while (1)
+    {
+        xQueueReceive(flashed_queue, &index, portMAX_DELAY);
+
+        if (index == FLUSH_REQUEST)
+        {
+            xSemaphoreGive(flush_semaphore);
+            continue;
+        }
+
+        /* A write failure reported meanwhile by the writer task must not be overwritten */
+        if (write_status == ERR_CODE_IN_PROGRESS)
+        {
+            types_error_code_e status = ota_process_verify_block(blocks[index].data, blocks[index].len);
+            if (status != ERR_CODE_IN_PROGRESS)
+            {
+                write_status = status;
+                report_fault(status);
+            }
+        }
+
+        blocks[index].len = 0;
+        xQueueSend(free_queue, &index, portMAX_DELAY);
+    }
+}
+
+/**
+ * @brief Hand the block being filled to the writer task
+ *
+ */
+static void submit_fill_block(void)
+{
+    if (fill_index == FLUSH_REQUEST)
+    {
+        return;
+    }
+
+    if (blocks[fill_index].len == 0)
+    {
+        xQueueSend(free_queue, &fill_index, portMAX_DELAY);
+    }
+    else
+    {
+        xQueueSend(filled_queue, &fill_index, portMAX_DELAY);
+    }
+
+    fill_index = FLUSH_REQUEST;
+}
+
+/**
+ * @brief Block until the writer task has handled every queued block
+ *
+ */
+static void wait_idle(void)
+{
+    uint8_t request = FLUSH_REQUEST;
+
+    xQueueSend(filled_queue, &request, portMAX_DELAY);
+    xSemaphoreTake(flush_semaphore, portMAX_DELAY);
+}
+
+/**
+ * @brief Tell the registered callback about a failed block
+ *
+ * @param status [in]: New write status
+ */
+static void report_fault(const types_error_code_e status)
+{
+    ota_writer_fault_cb_t fault_cb = fault_callback;
+
+    if ((status != ERR_CODE_OK) && (fault_cb != NULL))
+    {
+        fault_cb();
+    }
+}
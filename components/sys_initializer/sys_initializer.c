@@ -1,11 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "esp_log.h"
 #include "nvs_flash.h"
+#include "mbedtls/platform_util.h"
 #include "tcp_tls.h"
 #include "wifi_ap.h"
 #include "auth_hmac.h"
+#include "ota_manifest.h"
 #include "sys_initializer.h"
 
 
@@ -15,6 +18,9 @@ static const char *tag = "SYS_INITIALIZER";
 static types_error_code_e init_wifi_params(void);
 static types_error_code_e init_tcp_tls_params(void);
 static types_error_code_e init_auth_hmac_params(void);
+static types_error_code_e init_ota_manifest_params(void);
+static esp_err_t load_blob(nvs_handle_t nvs_handle, const char * p_key, uint8_t ** pp_out, size_t * p_out_len);
+static void release_blob(uint8_t * p_blob, const size_t len);
 
 /**
  * @brief Initialize the sys_initializer component
@@ -47,6 +53,12 @@ types_error_code_e sys_initializer_init(void)
     }
 
     err = init_auth_hmac_params();
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
+
+    err = init_ota_manifest_params();
 
     return err;
 }
@@ -112,26 +124,28 @@ static types_error_code_e init_wifi_params(void)
  */
 static types_error_code_e init_tcp_tls_params(void)
 {
-    uint8_t buffer[TCP_TLS_MAX_BUFFER_LEN] = {};
+    uint8_t *p_buffer = NULL;
+    size_t buffer_len = 0;
     
     nvs_handle_t nvs_handle = 0;
     ESP_ERROR_CHECK(nvs_open("tls_config", NVS_READONLY, &nvs_handle));
 
-    /* Server certificate initialization */
-    size_t buffer_len = sizeof(buffer);
-    ESP_ERROR_CHECK(nvs_get_blob(nvs_handle, "server_crt", buffer, &buffer_len));
+    /* Server certificate initialization, tcp_tls keeps the parsed certificate and the blob is released */
+    ESP_ERROR_CHECK(load_blob(nvs_handle, "server_crt", &p_buffer, &buffer_len));
 
-    types_error_code_e err = tcp_tls_set_server_crt(buffer, buffer_len);
+    types_error_code_e err = tcp_tls_set_server_crt(p_buffer, buffer_len + 1U);
+    release_blob(p_buffer, buffer_len);
     if (err != ERR_CODE_OK)
     {
+        nvs_close(nvs_handle);
         return err;
     }
 
     /* Server key initialization */
-    buffer_len = sizeof(buffer);
-    ESP_ERROR_CHECK(nvs_get_blob(nvs_handle, "server_key", buffer, &buffer_len));
+    ESP_ERROR_CHECK(load_blob(nvs_handle, "server_key", &p_buffer, &buffer_len));
         
-    err = tcp_tls_set_server_key(buffer, buffer_len);
+    err = tcp_tls_set_server_key(p_buffer, buffer_len + 1U);
+    release_blob(p_buffer, buffer_len);
 
     nvs_close(nvs_handle);
 
@@ -159,3 +173,84 @@ static types_error_code_e init_auth_hmac_params(void)
 
   return err;
 }
+
+/**
+ * @brief Initialize the manifest public key. It is optional, devices without one accept unsigned updates
+ * 
+ * @return types_error_code_e 
+ */
+static types_error_code_e init_ota_manifest_params(void)
+{
+  uint8_t *p_buffer = NULL;
+  size_t buffer_len = 0;
+    
+  nvs_handle_t nvs_handle = 0;
+  ESP_ERROR_CHECK(nvs_open("hmac_config", NVS_READONLY, &nvs_handle));
+
+  esp_err_t ret = load_blob(nvs_handle, "manifest_pubkey", &p_buffer, &buffer_len);
+  nvs_close(nvs_handle);
+
+  if (ret == ESP_ERR_NVS_NOT_FOUND)
+  {
+    ESP_LOGW(tag, "----- No manifest public key, unsigned updates are accepted -----");
+    return ERR_CODE_OK;
+  }
+  ESP_ERROR_CHECK(ret);
+
+  types_error_code_e err = ota_manifest_set_public_key(p_buffer, buffer_len + 1U);
+  release_blob(p_buffer, buffer_len);
+
+  return err;
+}
+
+/**
+ * @brief Read a blob into a heap buffer sized to its stored length. The buffer has one extra byte
+ * holding a NUL terminator, so PEM credentials can be parsed by mbedtls without another copy
+ * 
+ * @param nvs_handle [in]: Opened namespace handle
+ * @param p_key [in]: Blob key
+ * @param pp_out [out]: Blob buffer, released with release_blob
+ * @param p_out_len [out]: Blob length in bytes, without the terminator
+ * @return esp_err_t 
+ */
+static esp_err_t load_blob(nvs_handle_t nvs_handle, const char * p_key, uint8_t ** pp_out, size_t * p_out_len)
+{
+  size_t len = 0;
+  esp_err_t ret = nvs_get_blob(nvs_handle, p_key, NULL, &len);
+  if (ret != ESP_OK)
+  {
+    return ret;
+  }
+
+  uint8_t *p_blob = malloc(len + 1U);
+  if (p_blob == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+  ret = nvs_get_blob(nvs_handle, p_key, p_blob, &len);
+  if (ret != ESP_OK)
+  {
+    free(p_blob);
+    return ret;
+  }
+
+  p_blob[len] = '\0';
+
+  *pp_out = p_blob;
+  *p_out_len = len;
+
+  return ESP_OK;
+}
+
+/**
+ * @brief Wipe and free a blob loaded by load_blob, it may hold key material
+ * 
+ * @param p_blob [in]: Blob buffer
+ * @param len [in]: Blob length in bytes, without the terminator
+ */
+static void release_blob(uint8_t * p_blob, const size_t len)
+{
+  mbedtls_platform_zeroize(p_blob, len + 1U);
+  free(p_blob);
+}
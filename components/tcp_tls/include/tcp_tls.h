@@ -5,6 +5,13 @@
 #include "types.h"
 
 #define TCP_TLS_MAX_BUFFER_LEN      (4198U)
+#define TCP_TLS_PORT                (2000U)
+
+/* Reads are sized to the record payload negotiated with the client (max_fragment_length), up to this bound.
+ * Build with a smaller value to trade read calls for RAM */
+#ifndef TCP_TLS_RX_MAX_LEN_BYTES
+#define TCP_TLS_RX_MAX_LEN_BYTES    (16384U)
+#endif
 
 types_error_code_e tcp_tls_init(void);
 
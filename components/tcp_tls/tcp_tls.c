@@ -1,47 +1,114 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "lwip/sockets.h"
 #include "esp_tls.h"
+#include "esp_random.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/platform_util.h"
 #include "msg_parser.h"
 #include "auth_hmac.h"
 #include "ota_manager.h"
+#include "ota_metrics.h"
 #include "tcp_tls.h"
 
 
 #define PINNED_CORE                             (1)
+#define TASK_STACK_SIZE                         (8192U)
+#define TASK_PRIORITY                           (4)
+
+/* One connection per parser session, so a monitoring client is served while an update streams */
+#define MAX_CONNECTIONS                         (MSG_PARSER_MAX_SESSIONS)
 
 #define COUNT_NEEDED_TO_START_TCP_SOCKET        (2U)
-#define TCP_BUFFER_LEN_BYTES                    (2048U)
+#define TCP_DIRECT_READ_MIN_BYTES               (2048U) /* Windowed writer blocks with less room are filled through the rx buffer */
 
 #define KEEPIDLE_TIME_SEC                       (30)
 #define KEEPINTERVAL_SEC                        (5)
 #define KEEPCOUNT                               (2)
 
-#define RX_TIMEOUT_SEC                          (0)
-#define RX_TIMEOUT_USEC                         (500000)
+/* Every socket is non blocking, the event loop closes a connection that misses its deadline */
+#define RX_IDLE_TIMEOUT_MS                      (30000) /* Between transfers, e.g. a monitoring client */
+#define HANDSHAKE_TIMEOUT_MS                    (RX_IDLE_TIMEOUT_MS) /* Whole TLS handshake */
+#define RX_STALL_TIMEOUT_MS                     (2000) /* HMAC response and update data */
+#define TX_TIMEOUT_MS                           (2000)
 
 #define DELAY_AFTER_UPDATE_MS                   (200)
 
+/* The credentials are parsed once and handed to each handshake by the certificate selection hook */
+#if !defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+#error "tcp_tls requires CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK"
+#endif
+
+
+typedef enum {
+    CONN_FREE,
+    CONN_HANDSHAKE,     /* TLS handshake, continued each time the socket is ready */
+    CONN_AUTH,          /* Nonce sent, waiting for the HMAC response */
+    CONN_READY          /* Authenticated, application data goes to the parser */
+} conn_state_e;
+
 typedef struct {
-    uint8_t val[TCP_TLS_MAX_BUFFER_LEN];
-    size_t len;
-} crypt_buffer_t;
+    conn_state_e state;
+    esp_tls_t *tls;
+    int sock;
+    bool is_want_write;             /* The handshake waits for room in the send buffer */
+    int64_t deadline_us;            /* Closed when the socket is not ready before */
+    int64_t phase_start_us;         /* Handshake or HMAC phase, for ota_metrics */
+    msg_parser_session_t *p_session;
+    uint8_t *rx_buffer;
+    uint16_t rx_buffer_size;
+    uint8_t nonce[AUTH_HMAC_NONCE_LEN];
+} connection_t;
 
 
 static const char *tag = "TCP_TLS";
 
-static crypt_buffer_t server_crt = {};
-static crypt_buffer_t server_key = {};
+static mbedtls_x509_crt server_crt;
+static mbedtls_pk_context server_key;
+
+/* Shared by every connection, the session ticket keys included */
+static esp_tls_cfg_server_t server_cfg = {};
+
+static connection_t connections[MAX_CONNECTIONS] = {};
+
+/* select only waits on sockets, writer faults reach the event loop as a datagram on a loopback socket */
+static int event_sock = -1;
+static int notify_sock = -1;
+static struct sockaddr_in event_addr = {};
 
 /* ------------------- Private Functions ------------------- */
 
 static void tcp_tls_task(void * params);
-static types_error_code_e run_conn_rx(esp_tls_t *tls, const uint8_t * rx_buffer, const int32_t rx_len);
-static types_error_code_e hmac_validation(esp_tls_t * tls, uint8_t * p_rx_buffer, const uint32_t len_rx_buffer);
+static int open_listen_socket(void);
+static bool open_event_socket(void);
+static void notify_event(void);
+static void handle_events(void);
+static void accept_connection(const int listen_sock);
+static bool serve_connection(connection_t * p_conn);
+static bool continue_handshake(connection_t * p_conn);
+static bool start_auth(connection_t * p_conn);
+static bool check_auth(connection_t * p_conn);
+static bool receive_data(connection_t * p_conn);
+static void close_connection(connection_t * p_conn);
+static bool has_pending_data(connection_t * p_conn);
+static types_error_code_e run_conn_rx(connection_t * p_conn, const uint8_t * rx_buffer, const int32_t rx_len);
+static types_error_code_e send_ota_ack(connection_t * p_conn, const types_error_code_e err, const uint32_t bytes_read);
+static types_error_code_e conn_write(connection_t * p_conn, const uint8_t * p_data, const size_t len);
+static bool wait_socket(const int sock, const bool is_write, const int64_t deadline_us);
+static int select_server_crt(mbedtls_ssl_context * ssl);
+static uint16_t get_rx_buffer_len(esp_tls_t * tls);
+static types_error_code_e get_credential(const uint8_t * p_data, const size_t len, uint8_t ** pp_out, size_t * p_out_len);
+static void release_credential(uint8_t * p_copy, const size_t len);
+static int fill_random(void * p_ctx, unsigned char * p_buffer, size_t len);
 
 /* --------------------------------------------------------- */
 
@@ -52,18 +119,22 @@ static types_error_code_e hmac_validation(esp_tls_t * tls, uint8_t * p_rx_buffer
  */
 types_error_code_e tcp_tls_init(void)
 {
-    ESP_LOGI(tag, "----- Initializing tcp_tls task -----");
-    xTaskCreatePinnedToCore(tcp_tls_task, "tcp_tls_task", 8192, NULL, 4, NULL, PINNED_CORE);
-
     types_error_code_e err = msg_parser_init();
+    if (err != ERR_CODE_OK)
+    {
+        return err;
+    }
 
-    return err;
+    ESP_LOGI(tag, "----- Initializing tcp_tls task -----");
+    xTaskCreatePinnedToCore(tcp_tls_task, "tcp_tls_task", TASK_STACK_SIZE, NULL, TASK_PRIORITY, NULL, PINNED_CORE);
+
+    return ERR_CODE_OK;
 }
 
 /**
- * @brief Server_crt setter
+ * @brief Server_crt setter. The certificate is parsed once here and shared by every connection
  * 
- * @param crt [in]: Server certificate
+ * @param crt [in]: Server certificate, PEM or DER. A NUL terminated buffer is parsed in place
  * @param len [in]: Server certificate length in bytes
  * 
  * @return types_error_code_e 
@@ -84,9 +155,23 @@ types_error_code_e tcp_tls_set_server_crt(const uint8_t *crt, const size_t len)
         return ERR_CODE_INVALID_PARAM;
     }
 
-    memcpy(server_crt.val, crt, len);
-    server_crt.val[len] = '\0'; /* Needed to mbedtls */
-    server_crt.len = len + 1U;
+    uint8_t *p_pem = NULL;
+    size_t pem_len = 0;
+    if (get_credential(crt, len, &p_pem, &pem_len) != ERR_CODE_OK)
+    {
+        return ERR_CODE_FAIL;
+    }
+
+    mbedtls_x509_crt_init(&server_crt);
+    int ret = mbedtls_x509_crt_parse(&server_crt, (p_pem != NULL) ? p_pem : crt, pem_len);
+    release_credential(p_pem, pem_len);
+
+    if (ret != 0)
+    {
+        ESP_LOGE(tag, "----- Invalid server certificate: -0x%04X -----", (unsigned int)-ret);
+        mbedtls_x509_crt_free(&server_crt);
+        return ERR_CODE_INVALID_PARAM;
+    }
 
     has_server_crt_set = true;
 
@@ -96,9 +181,9 @@ types_error_code_e tcp_tls_set_server_crt(const uint8_t *crt, const size_t len)
 }
 
 /**
- * @brief Server_key setter
+ * @brief Server_key setter. The key is parsed once here and shared by every connection
  * 
- * @param key [in]: Server key
+ * @param key [in]: Server key, PEM or DER. A NUL terminated buffer is parsed in place
  * @param len [in]: Server key length in bytes
  * 
  * @return types_error_code_e 
@@ -119,9 +204,23 @@ types_error_code_e tcp_tls_set_server_key(const uint8_t *key, const size_t len)
         return ERR_CODE_INVALID_PARAM;
     }
 
-    memcpy(server_key.val, key, len);
-    server_key.val[len] = '\0'; /* Needed to mbedtls */
-    server_key.len = len + 1U;
+    uint8_t *p_pem = NULL;
+    size_t pem_len = 0;
+    if (get_credential(key, len, &p_pem, &pem_len) != ERR_CODE_OK)
+    {
+        return ERR_CODE_FAIL;
+    }
+
+    mbedtls_pk_init(&server_key);
+    int ret = mbedtls_pk_parse_key(&server_key, (p_pem != NULL) ? p_pem : key, pem_len, NULL, 0, fill_random, NULL);
+    release_credential(p_pem, pem_len);
+
+    if (ret != 0)
+    {
+        ESP_LOGE(tag, "----- Invalid server key: -0x%04X -----", (unsigned int)-ret);
+        mbedtls_pk_free(&server_key);
+        return ERR_CODE_INVALID_PARAM;
+    }
 
     has_server_key_set = true;
 
@@ -131,224 +230,733 @@ types_error_code_e tcp_tls_set_server_key(const uint8_t *key, const size_t len)
 }
 
 /**
- * @brief TLS main task
+ * @brief TLS server event loop. A single select waits on the listening socket, every connection and the
+ * writer fault events, then each ready socket is served without blocking
  * 
  * @param params [in]: Task parameters
  */
 static void tcp_tls_task(void * params)
 {
-    ESP_LOGI(tag, "----- Creating socket -----");
-    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-
-    struct sockaddr_in dest_addr = {
-        .sin_addr.s_addr = htonl(INADDR_ANY),
-        .sin_family = AF_INET,
-        .sin_port = htons(2000)
-    };
-
-    esp_tls_cfg_server_t server_cfg = {
-        .servercert_buf = server_crt.val,
-        .servercert_bytes = server_crt.len,
-        .serverkey_buf = server_key.val,
-        .serverkey_bytes = server_key.len
-    };
-
-    int keepAlive = 1;
-    int keepIdle = KEEPIDLE_TIME_SEC;
-    int keepInterval = KEEPINTERVAL_SEC;
-    int keepCount = KEEPCOUNT;
-
-    struct timeval rx_timeout = {
-        .tv_sec = RX_TIMEOUT_SEC,
-        .tv_usec = RX_TIMEOUT_USEC
-    };
+    server_cfg.cert_select_cb = select_server_crt;
 
-    ESP_LOGI(tag, "----- Binding socket -----");
-    int ret = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (ret != 0)
+    int listen_sock = open_listen_socket();
+    if ((listen_sock < 0) || !open_event_socket())
     {
-        ESP_LOGE(tag, "----- Can not bind the socket -----");
         vTaskDelete(NULL);
         return;
     }
 
-    ESP_LOGI(tag, "----- Creating listening socket -----");
-    ret = listen(listen_sock, 1);
-    if (ret != 0)
+    msg_parser_set_fault_cb(notify_event);
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+    /* Reconnecting clients resume with a ticket and skip the certificate and key exchange */
+    if (esp_tls_cfg_server_session_tickets_init(&server_cfg) != ESP_OK)
     {
-        ESP_LOGE(tag, "----- Can not listen the socket -----");
-        vTaskDelete(NULL);
-        return;
+        ESP_LOGW(tag, "----- Session tickets disabled, every connection runs a full handshake -----");
     }
+#endif
+
+    ESP_LOGI(tag, "----- Waiting for connections -----");
 
     while (1)
     {
-        struct sockaddr_storage source_addr = {};
-        socklen_t addr_len = sizeof(source_addr);
-
-        ESP_LOGI(tag, "----- Waiting for a connection -----");
-        int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-        if (sock < 0)
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        FD_SET(listen_sock, &read_fds);
+        FD_SET(event_sock, &read_fds);
+        int max_sock = MAX(listen_sock, event_sock);
+
+        /* Without connections, only a new client or a writer event wakes the loop */
+        int64_t now_us = esp_timer_get_time();
+        int64_t wait_us = -1;
+
+        for (uint8_t i = 0; i < MAX_CONNECTIONS; i++)
         {
-            ESP_LOGE(tag, "----- Unable to accept the connection -----");
-            continue;
+            connection_t *p_conn = &connections[i];
+            if (p_conn->state == CONN_FREE)
+            {
+                continue;
+            }
+
+            FD_SET(p_conn->sock, p_conn->is_want_write ? &write_fds : &read_fds);
+            max_sock = MAX(max_sock, p_conn->sock);
+
+            int64_t conn_wait_us = has_pending_data(p_conn) ? 0 : MAX(p_conn->deadline_us - now_us, 0);
+            wait_us = ((wait_us < 0) || (conn_wait_us < wait_us)) ? conn_wait_us : wait_us;
         }
 
-        /* Keep alive settings */
-        setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
-        setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
-        /* Receive timeout settings */
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &rx_timeout, sizeof(rx_timeout));
+        struct timeval timeout = {
+            .tv_sec = (time_t)(wait_us / 1000000),
+            .tv_usec = (suseconds_t)(wait_us % 1000000)
+        };
 
-        esp_tls_t *tls = esp_tls_init();
-        if (tls == NULL)
+        if (select(max_sock + 1, &read_fds, &write_fds, NULL, (wait_us < 0) ? NULL : &timeout) < 0)
         {
-            ESP_LOGE(tag, "----- Unable to create TLS section -----");
-            close(sock);
+            ESP_LOGE(tag, "----- Select failed -----");
             continue;
         }
 
-        if (esp_tls_server_session_create(&server_cfg, sock, tls) != 0)
+        if (FD_ISSET(event_sock, &read_fds))
         {
-            ESP_LOGE(tag, "----- Unable to establish TLS connection -----");
-            esp_tls_conn_destroy(tls);
-            continue;
+            handle_events();
         }
 
-        uint8_t rx_buffer[TCP_BUFFER_LEN_BYTES] = {};
-        
-        /* HMAC validation */
-        bool client_auth = (hmac_validation(tls, rx_buffer, sizeof(rx_buffer)) == ERR_CODE_OK) ? true : false;
+        now_us = esp_timer_get_time();
 
-        /* Only runs if client is authenticated */
-        while (client_auth)
+        for (uint8_t i = 0; i < MAX_CONNECTIONS; i++)
         {
-            int32_t rx_len = esp_tls_conn_read(tls, rx_buffer, sizeof(rx_buffer));
-            if (rx_len < 0)
-            {
-                ESP_LOGE(tag, "----- Receving error -----");
-                break;
-            }
-            else if (rx_len == 0)
+            connection_t *p_conn = &connections[i];
+            if (p_conn->state == CONN_FREE)
             {
-                ESP_LOGW(tag, "----- Client disconnected -----");
-                break;
+                continue;
             }
-            else
+
+            if (FD_ISSET(p_conn->sock, &read_fds) || FD_ISSET(p_conn->sock, &write_fds) || has_pending_data(p_conn))
             {
-                if (run_conn_rx(tls, rx_buffer, rx_len) != ERR_CODE_OK)
+                if (!serve_connection(p_conn))
                 {
-                    ESP_LOGE(tag, "----- Sending error -----");
-                    break;
+                    close_connection(p_conn);
                 }
             }
+            else if (now_us >= p_conn->deadline_us)
+            {
+                ESP_LOGW(tag, "----- Connection timed out -----");
+                close_connection(p_conn);
+            }
         }
 
-        /* Closing connection routine */
-        msg_parser_clean();
-        
-        ESP_LOGI(tag, "----- Closing socket -----");
-
-        esp_tls_conn_destroy(tls);
+        /* Accepted last, so a slot freed above is not mistaken for a ready socket */
+        if (FD_ISSET(listen_sock, &read_fds))
+        {
+            accept_connection(listen_sock);
+        }
     }
 
     ESP_LOGI(tag, "----- Closing listening socket -----");
 
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+    esp_tls_cfg_server_session_tickets_free(&server_cfg);
+#endif
+
     close(listen_sock);
     vTaskDelete(NULL);
 }
 
+/**
+ * @brief Create the non blocking listening socket of the server
+ * 
+ * @return int Listening socket, negative on error
+ */
+static int open_listen_socket(void)
+{
+    ESP_LOGI(tag, "----- Creating socket -----");
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+
+    struct sockaddr_in dest_addr = {
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_family = AF_INET,
+        .sin_port = htons(TCP_TLS_PORT)
+    };
+
+    ESP_LOGI(tag, "----- Binding socket -----");
+    int ret = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (ret != 0)
+    {
+        ESP_LOGE(tag, "----- Can not bind the socket -----");
+        close(listen_sock);
+        return -1;
+    }
+
+    ESP_LOGI(tag, "----- Creating listening socket -----");
+    ret = listen(listen_sock, MAX_CONNECTIONS);
+    if (ret != 0)
+    {
+        ESP_LOGE(tag, "----- Can not listen the socket -----");
+        close(listen_sock);
+        return -1;
+    }
+
+    /* A client gone between select and accept must not block the loop */
+    fcntl(listen_sock, F_SETFL, fcntl(listen_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    return listen_sock;
+}
+
+/**
+ * @brief Create the loopback datagram sockets carrying the writer events to the event loop
+ * 
+ * @return true on success
+ */
+static bool open_event_socket(void)
+{
+    event_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    notify_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+
+    event_addr.sin_family = AF_INET;
+    event_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    event_addr.sin_port = 0;
+    socklen_t addr_len = sizeof(event_addr);
+
+    if ((event_sock < 0) || (notify_sock < 0) ||
+        (bind(event_sock, (struct sockaddr *)&event_addr, sizeof(event_addr)) != 0) ||
+        (getsockname(event_sock, (struct sockaddr *)&event_addr, &addr_len) != 0))
+    {
+        ESP_LOGE(tag, "----- Can not create the event socket -----");
+        return false;
+    }
+
+    fcntl(event_sock, F_SETFL, fcntl(event_sock, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(notify_sock, F_SETFL, fcntl(notify_sock, F_GETFL, 0) | O_NONBLOCK);
+
+    return true;
+}
+
+/**
+ * @brief Wake the event loop. Runs on the ota_writer tasks when the update fails, a full event socket
+ * already holds a wake up
+ * 
+ */
+static void notify_event(void)
+{
+    uint8_t event = 1U;
+
+    sendto(notify_sock, &event, sizeof(event), 0, (struct sockaddr *)&event_addr, sizeof(event_addr));
+}
+
+/**
+ * @brief Drain the wake ups and end an update that failed in the background, so its client gets the OTA
+ * ack right away instead of after its next write
+ * 
+ */
+static void handle_events(void)
+{
+    uint8_t events[8] = {};
+
+    while (recv(event_sock, events, sizeof(events), 0) > 0)
+    {
+    }
+
+    for (uint8_t i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        connection_t *p_conn = &connections[i];
+        if ((p_conn->state != CONN_READY) || !msg_parser_is_updating(p_conn->p_session))
+        {
+            continue;
+        }
+
+        uint32_t bytes_read = 0;
+        types_error_code_e err = msg_parser_poll(p_conn->p_session, &bytes_read);
+
+        if ((err == ERR_CODE_FAIL) && (send_ota_ack(p_conn, err, bytes_read) != ERR_CODE_OK))
+        {
+            close_connection(p_conn);
+        }
+    }
+}
+
+/**
+ * @brief Accept a client into a free connection slot and start its TLS handshake
+ * 
+ * @param listen_sock [in]: Listening socket
+ */
+static void accept_connection(const int listen_sock)
+{
+    struct sockaddr_storage source_addr = {};
+    socklen_t addr_len = sizeof(source_addr);
+
+    int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+    if (sock < 0)
+    {
+        ESP_LOGE(tag, "----- Unable to accept the connection -----");
+        return;
+    }
+
+    connection_t *p_conn = NULL;
+    for (uint8_t i = 0; (i < MAX_CONNECTIONS) && (p_conn == NULL); i++)
+    {
+        p_conn = (connections[i].state == CONN_FREE) ? &connections[i] : NULL;
+    }
+
+    /* Refused right away rather than left waiting behind a long update */
+    if (p_conn == NULL)
+    {
+        ESP_LOGW(tag, "----- All connections busy, closing the connection -----");
+        close(sock);
+        return;
+    }
+
+    int keepAlive = 1;
+    int keepIdle = KEEPIDLE_TIME_SEC;
+    int keepInterval = KEEPINTERVAL_SEC;
+    int keepCount = KEEPCOUNT;
+
+    /* Keep alive settings */
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keepAlive, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keepIdle, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keepInterval, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keepCount, sizeof(int));
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    p_conn->tls = esp_tls_init();
+    if (p_conn->tls == NULL)
+    {
+        ESP_LOGE(tag, "----- Unable to create TLS section -----");
+        close(sock);
+        return;
+    }
+
+    p_conn->sock = sock;
+    p_conn->state = CONN_HANDSHAKE;
+    p_conn->phase_start_us = ota_metrics_start();
+    p_conn->deadline_us = esp_timer_get_time() + ((int64_t)HANDSHAKE_TIMEOUT_MS * 1000);
+
+    if (esp_tls_server_session_init(&server_cfg, sock, p_conn->tls) != ESP_OK)
+    {
+        ESP_LOGE(tag, "----- Unable to establish TLS connection -----");
+        close_connection(p_conn);
+    }
+}
+
+/**
+ * @brief Make progress on a connection whose socket is ready
+ * 
+ * @param p_conn [in]: Connection
+ * @return false when the connection must be closed
+ */
+static bool serve_connection(connection_t * p_conn)
+{
+    bool is_open = false;
+
+    switch (p_conn->state)
+    {
+        case CONN_HANDSHAKE:
+            is_open = continue_handshake(p_conn);
+        break;
+
+        case CONN_AUTH:
+            is_open = check_auth(p_conn);
+        break;
+
+        case CONN_READY:
+            is_open = receive_data(p_conn);
+        break;
+
+        default:
+            is_open = false;
+        break;
+    }
+
+    return is_open;
+}
+
+/**
+ * @brief Continue the TLS handshake, then challenge the client
+ * 
+ * @param p_conn [in]: Connection
+ * @return false when the connection must be closed
+ */
+static bool continue_handshake(connection_t * p_conn)
+{
+    int tls_ret = esp_tls_server_session_continue_async(p_conn->tls);
+
+    if ((tls_ret == ESP_TLS_ERR_SSL_WANT_READ) || (tls_ret == ESP_TLS_ERR_SSL_WANT_WRITE))
+    {
+        p_conn->is_want_write = (tls_ret == ESP_TLS_ERR_SSL_WANT_WRITE);
+        return true;
+    }
+
+    p_conn->is_want_write = false;
+    ota_metrics_stop(OTA_METRICS_PHASE_HANDSHAKE, p_conn->phase_start_us);
+
+    if (tls_ret != 0)
+    {
+        ESP_LOGE(tag, "----- Unable to establish TLS connection -----");
+        return false;
+    }
+
+    return start_auth(p_conn);
+}
+
+/**
+ * @brief Open the parser session of an established connection and send the HMAC challenge
+ * 
+ * @param p_conn [in]: Connection
+ * @return false when the connection must be closed
+ */
+static bool start_auth(connection_t * p_conn)
+{
+    if (msg_parser_open_session(&p_conn->p_session) != ERR_CODE_OK)
+    {
+        ESP_LOGE(tag, "----- Unable to open a parser session -----");
+        return false;
+    }
+
+    p_conn->rx_buffer_size = get_rx_buffer_len(p_conn->tls);
+    p_conn->rx_buffer = malloc(p_conn->rx_buffer_size);
+    if (p_conn->rx_buffer == NULL)
+    {
+        ESP_LOGE(tag, "----- Unable to allocate the receive buffer -----");
+        return false;
+    }
+
+    p_conn->phase_start_us = ota_metrics_start();
+    auth_hmac_generate_nonce(p_conn->nonce, sizeof(p_conn->nonce));
+
+    if (conn_write(p_conn, p_conn->nonce, sizeof(p_conn->nonce)) != ERR_CODE_OK)
+    {
+        return false;
+    }
+
+    p_conn->state = CONN_AUTH;
+    p_conn->deadline_us = esp_timer_get_time() + ((int64_t)RX_STALL_TIMEOUT_MS * 1000);
+
+    return true;
+}
+
+/**
+ * @brief HMAC validation routine, the first read must answer the challenge. Only an authenticated client
+ * reaches the parser
+ * 
+ * @param p_conn [in]: Connection
+ * @return false when the connection must be closed
+ */
+static bool check_auth(connection_t * p_conn)
+{
+    ssize_t rx_len = esp_tls_conn_read(p_conn->tls, p_conn->rx_buffer, p_conn->rx_buffer_size);
+
+    /* A partial record asks for another wait */
+    if ((rx_len == ESP_TLS_ERR_SSL_WANT_READ) || (rx_len == ESP_TLS_ERR_SSL_WANT_WRITE))
+    {
+        return true;
+    }
+
+    types_error_code_e err = ERR_CODE_FAIL;
+    if ((rx_len > 0) && auth_hmac_verify_response(p_conn->nonce, sizeof(p_conn->nonce), p_conn->rx_buffer, (size_t)rx_len))
+    {
+        uint8_t tx_buffer[MSG_PARSER_BUF_LEN_BYTES] = {};
+        uint8_t tx_len = 0;
+        msg_parser_build_firmware_ack(tx_buffer, sizeof(tx_buffer), &tx_len);
+
+        err = conn_write(p_conn, tx_buffer, tx_len);
+    }
+
+    ota_metrics_stop(OTA_METRICS_PHASE_HMAC, p_conn->phase_start_us);
+
+    if (err != ERR_CODE_OK)
+    {
+        return false;
+    }
+
+    p_conn->state = CONN_READY;
+    p_conn->deadline_us = esp_timer_get_time() + ((int64_t)RX_IDLE_TIMEOUT_MS * 1000);
+
+    return true;
+}
+
+/**
+ * @brief Read what an authenticated client sent and hand it to the parser
+ * 
+ * @param p_conn [in]: Connection
+ * @return false when the connection must be closed
+ */
+static bool receive_data(connection_t * p_conn)
+{
+    uint8_t *p_rx_buffer = p_conn->rx_buffer;
+    uint16_t rx_buffer_len = p_conn->rx_buffer_size;
+
+    /* Firmware lands straight in the flash writer block. Reads acked one by one must fit whole in it, so a
+     * record still gets a single ack, windowed clients may spread a record over several blocks */
+    uint8_t *p_block = NULL;
+    uint16_t block_len = 0;
+    uint16_t direct_min_len = msg_parser_is_windowed(p_conn->p_session) ? TCP_DIRECT_READ_MIN_BYTES : p_conn->rx_buffer_size;
+    if ((msg_parser_get_rx_buffer(p_conn->p_session, &p_block, &block_len) == ERR_CODE_OK) && 
+        (block_len >= direct_min_len))
+    {
+        p_rx_buffer = p_block;
+        rx_buffer_len = block_len;
+    }
+
+    ssize_t rx_len = esp_tls_conn_read(p_conn->tls, p_rx_buffer, rx_buffer_len);
+
+    /* A partial record asks for another wait */
+    if ((rx_len == ESP_TLS_ERR_SSL_WANT_READ) || (rx_len == ESP_TLS_ERR_SSL_WANT_WRITE))
+    {
+        return true;
+    }
+    else if (rx_len < 0)
+    {
+        ESP_LOGE(tag, "----- Receving error -----");
+        return false;
+    }
+    else if (rx_len == 0)
+    {
+        ESP_LOGW(tag, "----- Client disconnected -----");
+        return false;
+    }
+
+    if (run_conn_rx(p_conn, p_rx_buffer, (int32_t)rx_len) != ERR_CODE_OK)
+    {
+        ESP_LOGE(tag, "----- Sending error -----");
+        return false;
+    }
+
+    /* A transfer that stops streaming is dropped quickly, an idle client may stay connected */
+    uint32_t timeout_ms = msg_parser_is_updating(p_conn->p_session) ? RX_STALL_TIMEOUT_MS : RX_IDLE_TIMEOUT_MS;
+    p_conn->deadline_us = esp_timer_get_time() + ((int64_t)timeout_ms * 1000);
+
+    return true;
+}
+
+/**
+ * @brief Closing connection routine, the slot is free again on return
+ * 
+ * @param p_conn [in]: Connection
+ */
+static void close_connection(connection_t * p_conn)
+{
+    if (p_conn->p_session != NULL)
+    {
+        msg_parser_close_session(p_conn->p_session);
+    }
+
+    free(p_conn->rx_buffer);
+
+    ESP_LOGI(tag, "----- Closing socket -----");
+
+    esp_tls_conn_destroy(p_conn->tls);
+
+    memset(p_conn, 0, sizeof(*p_conn));
+}
+
+/**
+ * @brief Check for application bytes mbedTLS already pulled from the socket, they do not wake select
+ * 
+ * @param p_conn [in]: Connection
+ * @return true when a read can make progress without the socket being ready
+ */
+static bool has_pending_data(connection_t * p_conn)
+{
+    return (((p_conn->state == CONN_AUTH) || (p_conn->state == CONN_READY)) &&
+            (esp_tls_get_bytes_avail(p_conn->tls) > 0));
+}
+
 /**
  * @brief Run sockt receive logic
  * 
- * @param tls [in]: TLS handle
+ * @param p_conn [in]: Connection
  * @param rx_buffer [in]: Socket receive buffer
  * @param rx_len [in]: Socket receive buffer length
  * @return types_error_code_e 
  */
-static types_error_code_e run_conn_rx(esp_tls_t *tls, const uint8_t * rx_buffer, const int32_t rx_len)
+static types_error_code_e run_conn_rx(connection_t * p_conn, const uint8_t * rx_buffer, const int32_t rx_len)
 {
     uint32_t firmware_bytes_read = 0;
-    types_error_code_e err = msg_parser_run(rx_buffer, rx_len, &firmware_bytes_read);
+    types_error_code_e err = msg_parser_run(p_conn->p_session, rx_buffer, rx_len, &firmware_bytes_read);
     
     uint8_t tx_buffer[MSG_PARSER_BUF_LEN_BYTES] = {};
     uint8_t tx_len = 0;
 
-    msg_parser_build_firmware_ack(tx_buffer, sizeof(tx_buffer), &tx_len);
+    /* Legacy clients are acked on every read, windowed clients only when the window requires it */
+    msg_parser_build_rx_ack(p_conn->p_session, tx_buffer, sizeof(tx_buffer), &tx_len);
 
-    if (esp_tls_conn_write(tls, tx_buffer, tx_len) < 0)
+    if ((tx_len > 0) && (conn_write(p_conn, tx_buffer, tx_len) != ERR_CODE_OK))
     {
         return ERR_CODE_INVALID_OP;
     }
 
     if ((err == ERR_CODE_OK) || (err == ERR_CODE_FAIL))
     {
-        msg_parser_build_ota_ack(tx_buffer, sizeof(tx_buffer), (err == ERR_CODE_OK), firmware_bytes_read, &tx_len);
+        return send_ota_ack(p_conn, err, firmware_bytes_read);
+    }
 
-        if (esp_tls_conn_write(tls, tx_buffer, tx_len) < 0)
-        {
-            return ERR_CODE_INVALID_OP;
-        }
+    return ERR_CODE_OK;
+}
 
-        if (err == ERR_CODE_OK) {
-            vTaskDelay(pdMS_TO_TICKS(DELAY_AFTER_UPDATE_MS));
-            esp_restart();
-        }
+/**
+ * @brief Send the OTA ack closing an update, then restart into the new image after a success
+ * 
+ * @param p_conn [in]: Connection
+ * @param err [in]: Update result, ERR_CODE_OK or ERR_CODE_FAIL
+ * @param bytes_read [in]: Firmware bytes read
+ * @return types_error_code_e 
+ */
+static types_error_code_e send_ota_ack(connection_t * p_conn, const types_error_code_e err, const uint32_t bytes_read)
+{
+    uint8_t tx_buffer[MSG_PARSER_BUF_LEN_BYTES] = {};
+    uint8_t tx_len = 0;
+
+    msg_parser_build_ota_ack(tx_buffer, sizeof(tx_buffer), (err == ERR_CODE_OK), bytes_read, &tx_len);
+
+    if (conn_write(p_conn, tx_buffer, tx_len) != ERR_CODE_OK)
+    {
+        return ERR_CODE_INVALID_OP;
+    }
+
+    if (err == ERR_CODE_OK) {
+        vTaskDelay(pdMS_TO_TICKS(DELAY_AFTER_UPDATE_MS));
+        esp_restart();
     }
 
     return ERR_CODE_OK;
 }
 
 /**
- * @brief HMAC validation routine
+ * @brief Write the whole buffer, waiting in select while the socket send buffer is full. Acks fit in the
+ * send buffer, so the event loop only waits here on a client that stopped reading, up to TX_TIMEOUT_MS
  * 
- * @param tls [in]: TLS handle
- * @param p_rx_buffer [in]: Socket receive buffer
- * @param len_rx_buffer [in]: Socket receive buffer length
+ * @param p_conn [in]: Connection
+ * @param p_data [in]: Data buffer
+ * @param len [in]: Data buffer length
  * @return types_error_code_e 
  */
-static types_error_code_e hmac_validation(esp_tls_t * tls, uint8_t * p_rx_buffer, const uint32_t len_rx_buffer)
+static types_error_code_e conn_write(connection_t * p_conn, const uint8_t * p_data, const size_t len)
 {
-    uint8_t tx_buffer[AUTH_HMAC_NONCE_LEN] = {};
-    
-    auth_hmac_generate_nonce(tx_buffer, sizeof(tx_buffer));
+    int64_t deadline_us = esp_timer_get_time() + ((int64_t)TX_TIMEOUT_MS * 1000);
+    size_t written = 0;
 
-    if (esp_tls_conn_write(tls, tx_buffer, sizeof(tx_buffer)) < 0)
+    while (written < len)
     {
-        return ERR_CODE_INVALID_OP;
+        ssize_t ret = esp_tls_conn_write(p_conn->tls, p_data + written, len - written);
+        if (ret > 0)
+        {
+            written += (size_t)ret;
+        }
+        else if (((ret != ESP_TLS_ERR_SSL_WANT_READ) && (ret != ESP_TLS_ERR_SSL_WANT_WRITE)) ||
+                 !wait_socket(p_conn->sock, (ret == ESP_TLS_ERR_SSL_WANT_WRITE), deadline_us))
+        {
+            return ERR_CODE_FAIL;
+        }
     }
 
-    int32_t rx_len = esp_tls_conn_read(tls, p_rx_buffer, len_rx_buffer);
-    types_error_code_e err = ERR_CODE_OK;
-    if (rx_len < 0)
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Wait until a socket is readable or writable
+ * 
+ * @param sock [in]: Socket
+ * @param is_write [in]: True to wait for room in the send buffer, false for incoming data
+ * @param deadline_us [in]: esp_timer time to give up at
+ * @return true when the socket is ready
+ */
+static bool wait_socket(const int sock, const bool is_write, const int64_t deadline_us)
+{
+    int64_t remaining_us = deadline_us - esp_timer_get_time();
+    if (remaining_us <= 0)
     {
-        err = ERR_CODE_FAIL;
+        return false;
     }
-    else if (rx_len == 0)
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+
+    struct timeval timeout = {
+        .tv_sec = (time_t)(remaining_us / 1000000),
+        .tv_usec = (suseconds_t)(remaining_us % 1000000)
+    };
+
+    return (select(sock + 1, is_write ? NULL : &fds, is_write ? &fds : NULL, NULL, &timeout) > 0);
+}
+
+/**
+ * @brief Certificate selection hook, runs on every handshake and hands over the contexts parsed by the setters
+ * 
+ * @param ssl [in]: Handshake SSL context
+ * @return int 0 on success, mbedtls error code otherwise
+ */
+static int select_server_crt(mbedtls_ssl_context * ssl)
+{
+    return mbedtls_ssl_set_hs_own_cert(ssl, &server_crt, &server_key);
+}
+
+/**
+ * @brief Size the receive buffer to the largest record payload the client may send. Clients negotiating
+ * a smaller max_fragment_length get a smaller buffer, and every read returns up to a whole record
+ * 
+ * @param tls [in]: TLS handle, after the handshake
+ * @return uint16_t Receive buffer length in bytes
+ */
+static uint16_t get_rx_buffer_len(esp_tls_t * tls)
+{
+    mbedtls_ssl_context *p_ssl = esp_tls_get_ssl_context(tls);
+    int record_len = (p_ssl != NULL) ? mbedtls_ssl_get_max_in_record_payload(p_ssl) : 0;
+
+    uint16_t len = (record_len > 0) ? (uint16_t)MIN((uint32_t)record_len, TCP_TLS_RX_MAX_LEN_BYTES) :
+                                      TCP_DIRECT_READ_MIN_BYTES;
+
+    ESP_LOGI(tag, "----- Reading up to %u bytes per record -----", len);
+
+    return len;
+}
+
+/**
+ * @brief Get a credential mbedtls can parse. PEM input must be NUL terminated, buffers that are not
+ * get a terminated heap copy
+ * 
+ * @param p_data [in]: Credential buffer
+ * @param len [in]: Credential length in bytes
+ * @param pp_out [out]: Heap copy, NULL when p_data can be parsed in place
+ * @param p_out_len [out]: Length to hand to mbedtls
+ * @return types_error_code_e 
+ */
+static types_error_code_e get_credential(const uint8_t * p_data, const size_t len, uint8_t ** pp_out, size_t * p_out_len)
+{
+    *pp_out = NULL;
+    *p_out_len = len;
+
+    if ((len > 0) && (p_data[len - 1U] == '\0'))
     {
-        err = ERR_CODE_FAIL;
+        return ERR_CODE_OK;
     }
-    else
+
+    uint8_t *p_copy = malloc(len + 1U);
+    if (p_copy == NULL)
     {
-        if (auth_hmac_verify_response(tx_buffer, sizeof(tx_buffer), p_rx_buffer, rx_len))
-        {
-            uint8_t tx_len = 0;
-            msg_parser_build_firmware_ack(tx_buffer, sizeof(tx_buffer), &tx_len);
+        ESP_LOGE(tag, "----- Not enough memory to parse the credential -----");
+        return ERR_CODE_FAIL;
+    }
 
-            if (esp_tls_conn_write(tls, tx_buffer, tx_len) < 0)
-            {
-                return ERR_CODE_INVALID_OP;
-            }
+    memcpy(p_copy, p_data, len);
+    p_copy[len] = '\0';
 
-            err = ERR_CODE_OK;
-        }
-        else
-        {
-            err = ERR_CODE_FAIL;
-        }
+    *pp_out = p_copy;
+    *p_out_len = len + 1U;
+
+    return ERR_CODE_OK;
+}
+
+/**
+ * @brief Wipe and free a copy made by get_credential, it may hold the private key in clear
+ * 
+ * @param p_copy [in]: Heap copy, NULL when nothing was copied
+ * @param len [in]: Copy length in bytes
+ */
+static void release_credential(uint8_t * p_copy, const size_t len)
+{
+    if (p_copy == NULL)
+    {
+        return;
     }
 
-    return err;
+    mbedtls_platform_zeroize(p_copy, len);
+    free(p_copy);
+}
+
+/**
+ * @brief RNG used by mbedtls to blind the private key operations
+ * 
+ * @param p_ctx [in]: Unused context
+ * @param p_buffer [out]: Random bytes
+ * @param len [in]: Number of random bytes
+ * @return int Always 0
+ */
+static int fill_random(void * p_ctx, unsigned char * p_buffer, size_t len)
+{
+    esp_fill_random(p_buffer, len);
+
+    return 0;
 }
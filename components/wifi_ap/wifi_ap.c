@@ -15,7 +15,7 @@
 
 
 #define PASSWORD_MIN_LEN                    (8U) /* Min length of Wi-Fi API. Don't choose less than 8 bytes */
-#define MAX_CLIENTS                         (1U)
+#define MAX_CLIENTS                         (3U) /* An update client and the monitoring clients next to it */
 #define WIFI_CHANNEL                        (1U)
 
 
@@ -0,0 +1,7 @@
+#ifndef FAKE_ESP_ATTR_H
+#define FAKE_ESP_ATTR_H
+
+/* There is no RTC memory on the host, the data simply does not survive the process */
+#define RTC_NOINIT_ATTR
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FAKE_ESP_IMAGE_FORMAT_H
+#define FAKE_ESP_IMAGE_FORMAT_H
+
+/* Host fake of the bootloader_support image parser, backed by the flash simulator (see host_sim.h) */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+
+#define ESP_ERR_IMAGE_BASE          (0x2000)
+#define ESP_ERR_IMAGE_INVALID       (ESP_ERR_IMAGE_BASE + 2)
+
+
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} esp_partition_pos_t;
+
+/* Subset of the metadata filled in by the image parser */
+typedef struct {
+    uint32_t start_addr;
+    uint32_t image_len;         /* Including the checksum padding and the appended hash */
+} esp_image_metadata_t;
+
+
+esp_err_t esp_image_get_metadata(const esp_partition_pos_t * part, esp_image_metadata_t * metadata);
+
+#endif
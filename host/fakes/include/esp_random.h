@@ -0,0 +1,12 @@
+#ifndef FAKE_ESP_RANDOM_H
+#define FAKE_ESP_RANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+uint32_t esp_random(void);
+
+void esp_fill_random(void * p_buf, size_t len);
+
+#endif
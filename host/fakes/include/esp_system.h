@@ -0,0 +1,16 @@
+#ifndef FAKE_ESP_SYSTEM_H
+#define FAKE_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+/* Calls the hook installed with host_sim_set_restart_hook, exits the process otherwise */
+void esp_restart(void);
+
+const char *esp_get_idf_version(void);
+
+/* Free heap of a HOST_SIM_HEAP_SIZE_BYTES heap, counting every allocation of the process */
+uint32_t esp_get_free_heap_size(void);
+
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef FAKE_ESP_TIMER_H
+#define FAKE_ESP_TIMER_H
+
+#include <stdint.h>
+
+
+/* Microseconds since the process started, from the monotonic clock */
+int64_t esp_timer_get_time(void);
+
+#endif
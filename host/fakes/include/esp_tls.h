@@ -0,0 +1,80 @@
+#ifndef FAKE_ESP_TLS_H
+#define FAKE_ESP_TLS_H
+
+/* Host fake of the esp-tls server API, implemented on top of the host Mbed TLS */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+#include "esp_system.h"
+#if defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+#include "mbedtls/ssl.h"
+#endif
+
+
+/* Same values as the Mbed TLS codes esp-tls forwards, returned by reads and writes on non blocking sockets */
+#define ESP_TLS_ERR_SSL_WANT_READ       (-0x6900)
+#define ESP_TLS_ERR_SSL_WANT_WRITE      (-0x6880)
+
+typedef struct esp_tls esp_tls_t;
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+typedef struct esp_tls_server_session_ticket_ctx esp_tls_server_session_ticket_ctx_t;
+#endif
+
+#if defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+/* Called during the handshake, must call mbedtls_ssl_set_hs_own_cert when no certificate buffer is configured */
+typedef int (*esp_tls_server_cert_select_cb)(mbedtls_ssl_context * ssl);
+#endif
+
+typedef struct esp_tls_cfg_server {
+    const unsigned char * servercert_buf;
+    unsigned int servercert_bytes;
+    const unsigned char * serverkey_buf;
+    unsigned int serverkey_bytes;
+    const unsigned char * serverkey_password;
+    unsigned int serverkey_password_len;
+    void * userdata;
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+    esp_tls_server_session_ticket_ctx_t * ticket_ctx;
+#endif
+#if defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+    esp_tls_server_cert_select_cb cert_select_cb;
+#endif
+} esp_tls_cfg_server_t;
+
+
+esp_tls_t *esp_tls_init(void);
+
+int esp_tls_server_session_create(esp_tls_cfg_server_t * cfg, int sockfd, esp_tls_t * tls);
+
+/* Non blocking handshake: init once, then continue whenever the socket is ready until it returns 0 */
+esp_err_t esp_tls_server_session_init(esp_tls_cfg_server_t * cfg, int sockfd, esp_tls_t * tls);
+
+int esp_tls_server_session_continue_async(esp_tls_t * tls);
+
+void esp_tls_server_session_delete(esp_tls_t * tls);
+
+ssize_t esp_tls_conn_read(esp_tls_t * tls, void * data, size_t datalen);
+
+ssize_t esp_tls_conn_write(esp_tls_t * tls, const void * data, size_t datalen);
+
+int esp_tls_conn_destroy(esp_tls_t * tls);
+
+/* Application bytes already decrypted and waiting in the session */
+ssize_t esp_tls_get_bytes_avail(esp_tls_t * tls);
+
+/* Returns the mbedtls_ssl_context of the session */
+void *esp_tls_get_ssl_context(esp_tls_t * tls);
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+/* Ticket keys live in the configuration and rotate every CONFIG_ESP_TLS_SERVER_SESSION_TICKET_TIMEOUT seconds */
+esp_err_t esp_tls_cfg_server_session_tickets_init(esp_tls_cfg_server_t * cfg);
+
+void esp_tls_cfg_server_session_tickets_free(esp_tls_cfg_server_t * cfg);
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef FAKE_FREERTOS_H
+#define FAKE_FREERTOS_H
+
+/* Host fake of the FreeRTOS kernel API used by the components, backed by pthreads */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "esp_system.h"
+
+
+#define configTICK_RATE_HZ          (1000U)
+#define portTICK_PERIOD_MS          (1000U / configTICK_RATE_HZ)
+#define portMAX_DELAY               ((TickType_t)0xFFFFFFFFUL)
+
+#define pdFALSE                     ((BaseType_t)0)
+#define pdTRUE                      ((BaseType_t)1)
+#define pdFAIL                      (pdFALSE)
+#define pdPASS                      (pdTRUE)
+
+#define pdMS_TO_TICKS(ms)           ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000U))
+
+#define tskIDLE_PRIORITY            ((UBaseType_t)0U)
+#define tskNO_AFFINITY              ((BaseType_t)0x7FFFFFFF)
+
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct fake_task * TaskHandle_t;
+typedef struct fake_queue * QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#endif
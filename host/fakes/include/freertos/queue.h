@@ -0,0 +1,19 @@
+#ifndef FAKE_FREERTOS_QUEUE_H
+#define FAKE_FREERTOS_QUEUE_H
+
+#include "freertos/FreeRTOS.h"
+
+
+QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t item_size);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * p_item, TickType_t ticks_to_wait);
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * p_buffer, TickType_t ticks_to_wait);
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t queue);
+
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+void vQueueDelete(QueueHandle_t queue);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef FAKE_FREERTOS_SEMPHR_H
+#define FAKE_FREERTOS_SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+
+/* Semaphores are queues of zero sized items, as in FreeRTOS */
+#define vSemaphoreCreateBinary(sem)                                     \
+    do {                                                                \
+        (sem) = xQueueCreate(1U, 0U);                                   \
+        if ((sem) != NULL) { (void)xSemaphoreGive(sem); }               \
+    } while (0)
+
+#define xSemaphoreCreateBinary()            xQueueCreate(1U, 0U)
+#define xSemaphoreCreateMutex()             xSemaphoreCreateCounting(1U, 1U)
+#define xSemaphoreTake(sem, ticks)          xQueueReceive((sem), NULL, (ticks))
+#define xSemaphoreGive(sem)                 xQueueSend((sem), NULL, 0U)
+#define vSemaphoreDelete(sem)               vQueueDelete(sem)
+
+
+SemaphoreHandle_t xSemaphoreCreateCounting(const UBaseType_t max_count, const UBaseType_t initial_count);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef FAKE_FREERTOS_TASK_H
+#define FAKE_FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char * name, const uint32_t stack_depth,
+                                   void * params, UBaseType_t priority, TaskHandle_t * p_created_task,
+                                   const BaseType_t core_id);
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char * name, const uint32_t stack_depth,
+                       void * params, UBaseType_t priority, TaskHandle_t * p_created_task);
+
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(const TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+#endif
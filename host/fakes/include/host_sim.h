@@ -0,0 +1,68 @@
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+/* Control surface of the host fakes, only available in the Linux host build */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+
+#define HOST_SIM_FLASH_SIZE_BYTES           (4U * 1024U * 1024U)
+#define HOST_SIM_HEAP_SIZE_BYTES            (300U * 1024U) /* Typical free DRAM heap with Wi-Fi running */
+
+/* Typical timings of the 4 MB SPI NOR flash found on ESP32 modules */
+#define HOST_SIM_FLASH_LATENCY_TYPICAL      { .sector_erase_us = 45000U, .block_erase_us = 150000U, .page_program_us = 400U }
+#define HOST_SIM_FLASH_LATENCY_NONE         { .sector_erase_us = 0U, .block_erase_us = 0U, .page_program_us = 0U }
+
+
+typedef struct {
+    uint32_t sector_erase_us;   /* 4 KB sector erase */
+    uint32_t block_erase_us;    /* 64 KB block erase, used for aligned ranges */
+    uint32_t page_program_us;   /* 256 bytes page program */
+} host_sim_flash_latency_t;
+
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_programmed;
+    uint32_t sectors_erased;
+    uint64_t busy_us;           /* Simulated erase and program time */
+    uint32_t ota_handles_opened; /* esp_ota_begin and esp_ota_resume calls that succeeded */
+} host_sim_flash_stats_t;
+
+typedef struct {
+    int64_t end_start_us;       /* esp_ota_end, including the image validation */
+    int64_t end_done_us;
+    int64_t set_boot_start_us;  /* esp_ota_set_boot_partition */
+    int64_t set_boot_done_us;
+} host_sim_ota_timestamps_t;
+
+typedef struct {
+    uint64_t in_use_bytes;
+    uint64_t peak_bytes;
+} host_sim_heap_stats_t;
+
+typedef void (*host_sim_restart_hook_t)(void);
+
+
+esp_err_t host_sim_flash_init(const char * path);
+
+void host_sim_flash_deinit(void);
+
+void host_sim_flash_set_latency(const host_sim_flash_latency_t * p_latency);
+
+void host_sim_flash_get_stats(host_sim_flash_stats_t * p_stats);
+
+void host_sim_flash_reset_stats(void);
+
+void host_sim_get_ota_timestamps(host_sim_ota_timestamps_t * p_timestamps);
+
+esp_err_t host_sim_set_running_partition(const char * label);
+
+void host_sim_set_restart_hook(host_sim_restart_hook_t hook);
+
+void host_sim_heap_get_stats(host_sim_heap_stats_t * p_stats);
+
+void host_sim_heap_reset_peak(void);
+
+#endif
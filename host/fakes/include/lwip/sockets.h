@@ -0,0 +1,16 @@
+#ifndef FAKE_LWIP_SOCKETS_H
+#define FAKE_LWIP_SOCKETS_H
+
+/* Host fake of the lwIP socket API, the BSD names map straight to the POSIX sockets */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef FAKE_ROM_MINIZ_H
+#define FAKE_ROM_MINIZ_H
+
+/* Host fake of the ROM tinfl inflater, implemented on top of zlib.
+ * zlib keeps its own dictionary, so the circular output buffer is only written, never read back.
+ * zlib's state is released when the stream ends, streams abandoned halfway leak it. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <zlib.h>
+
+
+#define TINFL_LZ_DICT_SIZE      (32768)
+
+
+typedef unsigned char mz_uint8;
+typedef uint32_t mz_uint32;
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef struct {
+    mz_uint32 m_state;
+    z_stream stream;
+} tinfl_decompressor;
+
+#define tinfl_init(r)       do { (r)->m_state = 0; } while (0)
+
+
+tinfl_status tinfl_decompress(tinfl_decompressor * r, const mz_uint8 * pIn_buf_next, size_t * pIn_buf_size,
+                              mz_uint8 * pOut_buf_start, mz_uint8 * pOut_buf_next, size_t * pOut_buf_size,
+                              const mz_uint32 decomp_flags);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_app_desc.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "host_sim.h"
+
+
+static esp_log_level_t log_level = ESP_LOG_INFO;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static host_sim_restart_hook_t restart_hook = NULL;
+
+static struct timespec start_time = {};
+static pthread_once_t start_time_once = PTHREAD_ONCE_INIT;
+
+
+static void init_start_time(void);
+
+/* --------------------------------- esp_err --------------------------------- */
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK:                            return "ESP_OK";
+        case ESP_FAIL:                          return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:                    return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:               return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:             return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:              return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:                 return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:             return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:                   return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_INITIALIZED:       return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND:             return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE:        return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_READ_ONLY:             return "ESP_ERR_NVS_READ_ONLY";
+        case ESP_ERR_NVS_INVALID_LENGTH:        return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_OTA_PARTITION_CONFLICT:    return "ESP_ERR_OTA_PARTITION_CONFLICT";
+        case ESP_ERR_OTA_VALIDATE_FAILED:       return "ESP_ERR_OTA_VALIDATE_FAILED";
+        default:                                return "UNKNOWN ERROR";
+    }
+}
+
+/* --------------------------------- esp_log --------------------------------- */
+
+/**
+ * @brief Set the log level of every tag, per tag levels are not simulated
+ */
+void esp_log_level_set(const char * tag, esp_log_level_t level)
+{
+    (void)tag;
+
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char * tag, const char * format, ...)
+{
+    static const char level_letter[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+
+    if (level > log_level)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    pthread_mutex_lock(&log_mutex);
+    fprintf(stderr, "%c (%lld) %s: ", level_letter[level], (long long)(esp_timer_get_time() / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    pthread_mutex_unlock(&log_mutex);
+
+    va_end(args);
+}
+
+/* -------------------------------- esp_system ------------------------------- */
+
+void esp_restart(void)
+{
+    if (restart_hook != NULL)
+    {
+        restart_hook();
+        return;
+    }
+
+    exit(EXIT_SUCCESS);
+}
+
+const char *esp_get_idf_version(void)
+{
+    return "host";
+}
+
+void host_sim_set_restart_hook(host_sim_restart_hook_t hook)
+{
+    restart_hook = hook;
+}
+
+/* ------------------------------- esp_app_desc ------------------------------ */
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    static const esp_app_desc_t app_desc = {
+        .magic_word = ESP_APP_DESC_MAGIC_WORD,
+        .version = "host",
+        .project_name = "ota_tcp_esp32"
+    };
+
+    return &app_desc;
+}
+
+/* -------------------------------- esp_random ------------------------------- */
+
+uint32_t esp_random(void)
+{
+    uint32_t value = 0;
+
+    esp_fill_random(&value, sizeof(value));
+
+    return value;
+}
+
+void esp_fill_random(void * p_buf, size_t len)
+{
+    uint8_t *p_bytes = p_buf;
+
+    while (len > 0)
+    {
+        ssize_t ret = getrandom(p_bytes, len, 0);
+        if (ret < 0)
+        {
+            abort();
+        }
+
+        p_bytes += ret;
+        len -= (size_t)ret;
+    }
+}
+
+/* -------------------------------- esp_timer -------------------------------- */
+
+int64_t esp_timer_get_time(void)
+{
+    pthread_once(&start_time_once, init_start_time);
+
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((int64_t)(now.tv_sec - start_time.tv_sec) * 1000000) + ((now.tv_nsec - start_time.tv_nsec) / 1000);
+}
+
+static void init_start_time(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+/* ------------------------------- driver/gpio ------------------------------- */
+
+esp_err_t gpio_config(const gpio_config_t * p_config)
+{
+    return (p_config != NULL) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    (void)gpio_num;
+    (void)level;
+
+    return ESP_OK;
+}
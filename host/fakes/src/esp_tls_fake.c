@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+#include "mbedtls/ssl_ticket.h"
+#endif
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+#include "psa/crypto.h"
+#endif
+
+#include "esp_log.h"
+#include "esp_tls.h"
+
+
+struct esp_tls {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_x509_crt servercert;
+    mbedtls_pk_context serverkey;
+    mbedtls_net_context server_fd;
+    bool is_session_set;
+};
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+struct esp_tls_server_session_ticket_ctx {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctr_drbg;
+    mbedtls_ssl_ticket_context ticket_ctx;
+};
+#endif
+
+
+static const char *tag = "ESP_TLS_FAKE";
+
+
+static int setup_session(const esp_tls_cfg_server_t * cfg, esp_tls_t * tls);
+
+esp_tls_t *esp_tls_init(void)
+{
+    esp_tls_t *tls = calloc(1, sizeof(esp_tls_t));
+    if (tls == NULL)
+    {
+        return NULL;
+    }
+
+    mbedtls_net_init(&tls->server_fd);
+
+    return tls;
+}
+
+/**
+ * @brief Run the server handshake on an accepted socket. Like the target, the session is TLS 1.2 only
+ */
+int esp_tls_server_session_create(esp_tls_cfg_server_t * cfg, int sockfd, esp_tls_t * tls)
+{
+    if (esp_tls_server_session_init(cfg, sockfd, tls) != ESP_OK)
+    {
+        return -1;
+    }
+
+    int ret = ESP_TLS_ERR_SSL_WANT_READ;
+
+    while ((ret == ESP_TLS_ERR_SSL_WANT_READ) || (ret == ESP_TLS_ERR_SSL_WANT_WRITE))
+    {
+        ret = esp_tls_server_session_continue_async(tls);
+    }
+
+    if (ret != 0)
+    {
+        esp_tls_server_session_delete(tls);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Set up the server session of an accepted socket, the handshake is then driven by
+ * esp_tls_server_session_continue_async
+ */
+esp_err_t esp_tls_server_session_init(esp_tls_cfg_server_t * cfg, int sockfd, esp_tls_t * tls)
+{
+    if ((cfg == NULL) || (tls == NULL) || (sockfd < 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    tls->server_fd.fd = sockfd;
+
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_entropy_init(&tls->entropy);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    mbedtls_x509_crt_init(&tls->servercert);
+    mbedtls_pk_init(&tls->serverkey);
+    tls->is_session_set = true;
+
+    if (setup_session(cfg, tls) != 0)
+    {
+        esp_tls_server_session_delete(tls);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Make progress on the handshake, 0 once done, the want read/write codes while the socket has to
+ * become ready again, another negative code when the handshake failed
+ */
+int esp_tls_server_session_continue_async(esp_tls_t * tls)
+{
+    int ret = mbedtls_ssl_handshake(&tls->ssl);
+
+    if ((ret != 0) && (ret != MBEDTLS_ERR_SSL_WANT_READ) && (ret != MBEDTLS_ERR_SSL_WANT_WRITE))
+    {
+        ESP_LOGE(tag, "----- Handshake failed: -0x%04X -----", (unsigned int)-ret);
+    }
+
+    return ret;
+}
+
+void esp_tls_server_session_delete(esp_tls_t * tls)
+{
+    if ((tls == NULL) || !tls->is_session_set)
+    {
+        return;
+    }
+
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_pk_free(&tls->serverkey);
+    mbedtls_x509_crt_free(&tls->servercert);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+    tls->is_session_set = false;
+}
+
+/**
+ * @brief Read application data, 0 when the peer closed the session
+ */
+ssize_t esp_tls_conn_read(esp_tls_t * tls, void * data, size_t datalen)
+{
+    int ret = mbedtls_ssl_read(&tls->ssl, data, datalen);
+
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+    {
+        return 0;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Write the buffer, splitting it in as many records as needed. Like esp-tls, a non blocking socket
+ * that fills up ends the write early with the bytes written so far, or the want read/write code
+ */
+ssize_t esp_tls_conn_write(esp_tls_t * tls, const void * data, size_t datalen)
+{
+    const unsigned char *p_data = data;
+    size_t written = 0;
+
+    while (written < datalen)
+    {
+        int ret = mbedtls_ssl_write(&tls->ssl, p_data + written, datalen - written);
+
+        if (ret < 0)
+        {
+            return (written > 0) ? (ssize_t)written : ret;
+        }
+
+        written += (size_t)ret;
+    }
+
+    return (ssize_t)written;
+}
+
+/**
+ * @brief Application bytes already decrypted and waiting in the session
+ */
+ssize_t esp_tls_get_bytes_avail(esp_tls_t * tls)
+{
+    return (ssize_t)mbedtls_ssl_get_bytes_avail(&tls->ssl);
+}
+
+/**
+ * @brief Close the session and its socket, then release the handle
+ */
+int esp_tls_conn_destroy(esp_tls_t * tls)
+{
+    if (tls == NULL)
+    {
+        return -1;
+    }
+
+    if (tls->is_session_set)
+    {
+        mbedtls_ssl_close_notify(&tls->ssl);
+    }
+
+    esp_tls_server_session_delete(tls);
+
+    if (tls->server_fd.fd >= 0)
+    {
+        close(tls->server_fd.fd);
+    }
+
+    free(tls);
+
+    return 0;
+}
+
+void *esp_tls_get_ssl_context(esp_tls_t * tls)
+{
+    return (tls != NULL) ? &tls->ssl : NULL;
+}
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+/**
+ * @brief Create the ticket keys shared by every session created with this configuration
+ */
+esp_err_t esp_tls_cfg_server_session_tickets_init(esp_tls_cfg_server_t * cfg)
+{
+    if ((cfg == NULL) || (cfg->ticket_ctx != NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_tls_server_session_ticket_ctx_t *ctx = calloc(1, sizeof(esp_tls_server_session_ticket_ctx_t));
+    if (ctx == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    mbedtls_entropy_init(&ctx->entropy);
+    mbedtls_ctr_drbg_init(&ctx->ctr_drbg);
+    mbedtls_ssl_ticket_init(&ctx->ticket_ctx);
+
+    if ((mbedtls_ctr_drbg_seed(&ctx->ctr_drbg, mbedtls_entropy_func, &ctx->entropy, NULL, 0) != 0) ||
+        (mbedtls_ssl_ticket_setup(&ctx->ticket_ctx, mbedtls_ctr_drbg_random, &ctx->ctr_drbg, MBEDTLS_CIPHER_AES_256_GCM,
+                                  CONFIG_ESP_TLS_SERVER_SESSION_TICKET_TIMEOUT) != 0))
+    {
+        cfg->ticket_ctx = ctx;
+        esp_tls_cfg_server_session_tickets_free(cfg);
+        return ESP_FAIL;
+    }
+
+    cfg->ticket_ctx = ctx;
+
+    return ESP_OK;
+}
+
+void esp_tls_cfg_server_session_tickets_free(esp_tls_cfg_server_t * cfg)
+{
+    if ((cfg == NULL) || (cfg->ticket_ctx == NULL))
+    {
+        return;
+    }
+
+    mbedtls_ssl_ticket_free(&cfg->ticket_ctx->ticket_ctx);
+    mbedtls_ctr_drbg_free(&cfg->ticket_ctx->ctr_drbg);
+    mbedtls_entropy_free(&cfg->ticket_ctx->entropy);
+    free(cfg->ticket_ctx);
+    cfg->ticket_ctx = NULL;
+}
+#endif
+
+static int setup_session(const esp_tls_cfg_server_t * cfg, esp_tls_t * tls)
+{
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+    if (psa_crypto_init() != PSA_SUCCESS)
+    {
+        return -1;
+    }
+#endif
+
+    /* Like esp-tls, the certificate selection hook stands in for missing certificate buffers */
+    bool has_buffers = (cfg->servercert_buf != NULL) && (cfg->serverkey_buf != NULL);
+#if defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+    if (!has_buffers && (cfg->cert_select_cb == NULL))
+#else
+    if (!has_buffers)
+#endif
+    {
+        ESP_LOGE(tag, "----- Missing server certificate and/or key -----");
+        return -1;
+    }
+
+    int ret = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy, NULL, 0);
+
+    if ((ret == 0) && has_buffers)
+    {
+        ret = mbedtls_x509_crt_parse(&tls->servercert, cfg->servercert_buf, cfg->servercert_bytes);
+    }
+
+    if ((ret == 0) && has_buffers)
+    {
+        ret = mbedtls_pk_parse_key(&tls->serverkey, cfg->serverkey_buf, cfg->serverkey_bytes,
+                                   cfg->serverkey_password, cfg->serverkey_password_len,
+                                   mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    }
+
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+
+    if (ret == 0)
+    {
+        mbedtls_ssl_conf_max_tls_version(&tls->conf, MBEDTLS_SSL_VERSION_TLS1_2);
+        mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    }
+
+    if ((ret == 0) && has_buffers)
+    {
+        ret = mbedtls_ssl_conf_own_cert(&tls->conf, &tls->servercert, &tls->serverkey);
+    }
+
+#if defined(CONFIG_ESP_TLS_SERVER_CERT_SELECT_HOOK)
+    if ((ret == 0) && (cfg->cert_select_cb != NULL))
+    {
+        mbedtls_ssl_conf_cert_cb(&tls->conf, cfg->cert_select_cb);
+    }
+#endif
+
+#if defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+    if ((ret == 0) && (cfg->ticket_ctx != NULL))
+    {
+        mbedtls_ssl_conf_session_tickets_cb(&tls->conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse,
+                                            &cfg->ticket_ctx->ticket_ctx);
+    }
+#endif
+
+    if (ret == 0)
+    {
+        ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    }
+
+    if (ret == 0)
+    {
+        mbedtls_ssl_set_bio(&tls->ssl, &tls->server_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
+    }
+
+    return ret;
+}
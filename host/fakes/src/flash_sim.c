@@ -0,0 +1,728 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp_partition.h"
+#include "esp_ota_ops.h"
+#include "esp_image_format.h"
+#include "esp_timer.h"
+#include "host_sim.h"
+
+
+#define FLASH_PAGE_SIZE             (256U)
+#define FLASH_BLOCK_SIZE            (64U * 1024U)
+#define IMAGE_HEADER_MAGIC          (0xE9U)
+#define IMAGE_HEADER_SIZE           (24U)
+#define IMAGE_SEGMENT_HEADER_SIZE   (8U)
+#define IMAGE_MAX_SEGMENTS          (16U)
+#define IMAGE_HASH_APPENDED_OFFSET  (23U)
+#define IMAGE_CHECKSUM_ALIGN        (16U)
+#define IMAGE_HASH_LEN              (32U)
+
+#define OTA_SLOT_COUNT              (2U)
+#define MAX_OTA_HANDLES             (4U)
+#define OTADATA_INDEX               (1U)
+#define FIRST_OTA_INDEX             (3U)
+
+#define ALIGN_UP(x, a)              ((((x) + (a) - 1U) / (a)) * (a))
+
+
+typedef struct {
+    bool in_use;
+    esp_ota_handle_t handle;
+    const esp_partition_t *partition;
+    size_t erased_size;
+    size_t wrote_size;
+} ota_handle_entry_t;
+
+
+/* Layout modelled on partitions_two_ota_large.csv, with the 0x6000 NVS of scripts/load_nvs_config */
+static const esp_partition_t partition_table[] = {
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_NVS,
+      .address = 0x9000, .size = 0x6000, .erase_size = SPI_FLASH_SEC_SIZE, .label = "nvs" },
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_OTA,
+      .address = 0xF000, .size = 0x2000, .erase_size = SPI_FLASH_SEC_SIZE, .label = "otadata" },
+    { .type = ESP_PARTITION_TYPE_DATA, .subtype = ESP_PARTITION_SUBTYPE_DATA_PHY,
+      .address = 0x11000, .size = 0x1000, .erase_size = SPI_FLASH_SEC_SIZE, .label = "phy_init" },
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_0,
+      .address = 0x20000, .size = 0x1A9000, .erase_size = SPI_FLASH_SEC_SIZE, .label = "ota_0" },
+    { .type = ESP_PARTITION_TYPE_APP, .subtype = ESP_PARTITION_SUBTYPE_APP_OTA_1,
+      .address = 0x1D0000, .size = 0x1A9000, .erase_size = SPI_FLASH_SEC_SIZE, .label = "ota_1" },
+};
+
+static pthread_mutex_t flash_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *p_flash = NULL;
+static int flash_fd = -1;
+
+static host_sim_flash_latency_t latency = HOST_SIM_FLASH_LATENCY_NONE;
+static host_sim_flash_stats_t stats = {};
+static host_sim_ota_timestamps_t ota_timestamps = {};
+
+static uint8_t running_slot = 0;
+static uint8_t boot_slot = 0;
+static esp_ota_img_states_t slot_states[OTA_SLOT_COUNT] = { ESP_OTA_IMG_VALID, ESP_OTA_IMG_VALID };
+
+static ota_handle_entry_t ota_handles[MAX_OTA_HANDLES] = {};
+static esp_ota_handle_t last_ota_handle = 0;
+
+
+static esp_err_t check_range(const esp_partition_t * partition, size_t offset, size_t size);
+static void erase_locked(uint32_t address, size_t size);
+static void program_locked(uint32_t address, const void * src, size_t size);
+static void busy_wait(uint64_t us);
+static int slot_of(const esp_partition_t * partition);
+static ota_handle_entry_t *find_handle(esp_ota_handle_t handle);
+static esp_err_t open_handle(const esp_partition_t * partition, size_t erased_size, size_t wrote_size,
+                             esp_ota_handle_t * out_handle);
+static void store_boot_slot_locked(void);
+
+/* ------------------------------- host_sim ------------------------------- */
+
+/**
+ * @brief Map the flash image file, creating an erased one when it does not exist. The simulated
+ * device boots from the slot recorded in otadata by the previous run
+ */
+esp_err_t host_sim_flash_init(const char * path)
+{
+    flash_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (flash_fd < 0)
+    {
+        return ESP_FAIL;
+    }
+
+    struct stat st = {};
+    fstat(flash_fd, &st);
+    bool is_new = (st.st_size != HOST_SIM_FLASH_SIZE_BYTES);
+
+    if (is_new && (ftruncate(flash_fd, HOST_SIM_FLASH_SIZE_BYTES) != 0))
+    {
+        close(flash_fd);
+        return ESP_FAIL;
+    }
+
+    p_flash = mmap(NULL, HOST_SIM_FLASH_SIZE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, flash_fd, 0);
+    if (p_flash == MAP_FAILED)
+    {
+        p_flash = NULL;
+        close(flash_fd);
+        return ESP_FAIL;
+    }
+
+    if (is_new)
+    {
+        memset(p_flash, 0xFF, HOST_SIM_FLASH_SIZE_BYTES);
+    }
+
+    uint8_t stored_slot = p_flash[partition_table[OTADATA_INDEX].address];
+    boot_slot = (stored_slot < OTA_SLOT_COUNT) ? stored_slot : 0;
+    running_slot = boot_slot;
+
+    return ESP_OK;
+}
+
+void host_sim_flash_deinit(void)
+{
+    if (p_flash != NULL)
+    {
+        msync(p_flash, HOST_SIM_FLASH_SIZE_BYTES, MS_SYNC);
+        munmap(p_flash, HOST_SIM_FLASH_SIZE_BYTES);
+        close(flash_fd);
+        p_flash = NULL;
+    }
+}
+
+void host_sim_flash_set_latency(const host_sim_flash_latency_t * p_latency)
+{
+    pthread_mutex_lock(&flash_mutex);
+    latency = *p_latency;
+    pthread_mutex_unlock(&flash_mutex);
+}
+
+void host_sim_flash_get_stats(host_sim_flash_stats_t * p_stats)
+{
+    pthread_mutex_lock(&flash_mutex);
+    *p_stats = stats;
+    pthread_mutex_unlock(&flash_mutex);
+}
+
+void host_sim_flash_reset_stats(void)
+{
+    pthread_mutex_lock(&flash_mutex);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&flash_mutex);
+}
+
+void host_sim_get_ota_timestamps(host_sim_ota_timestamps_t * p_timestamps)
+{
+    *p_timestamps = ota_timestamps;
+}
+
+esp_err_t host_sim_set_running_partition(const char * label)
+{
+    for (uint8_t i = 0; i < OTA_SLOT_COUNT; i++)
+    {
+        if (strcmp(partition_table[FIRST_OTA_INDEX + i].label, label) == 0)
+        {
+            running_slot = i;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+/* ----------------------------- esp_partition ----------------------------- */
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char * label)
+{
+    for (size_t i = 0; i < (sizeof(partition_table) / sizeof(partition_table[0])); i++)
+    {
+        const esp_partition_t *p_part = &partition_table[i];
+
+        if (((type == ESP_PARTITION_TYPE_ANY) || (p_part->type == type)) &&
+            ((subtype == ESP_PARTITION_SUBTYPE_ANY) || (p_part->subtype == subtype)) &&
+            ((label == NULL) || (strcmp(p_part->label, label) == 0)))
+        {
+            return p_part;
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t * partition, size_t src_offset, void * dst, size_t size)
+{
+    esp_err_t err = check_range(partition, src_offset, size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    pthread_mutex_lock(&flash_mutex);
+    memcpy(dst, p_flash + partition->address + src_offset, size);
+    stats.bytes_read += size;
+    pthread_mutex_unlock(&flash_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t * partition, size_t dst_offset, const void * src, size_t size)
+{
+    esp_err_t err = check_range(partition, dst_offset, size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    pthread_mutex_lock(&flash_mutex);
+    program_locked(partition->address + dst_offset, src, size);
+    pthread_mutex_unlock(&flash_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t * partition, size_t offset, size_t size)
+{
+    if (((offset % SPI_FLASH_SEC_SIZE) != 0) || ((size % SPI_FLASH_SEC_SIZE) != 0))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    esp_err_t err = check_range(partition, offset, size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    pthread_mutex_lock(&flash_mutex);
+    erase_locked(partition->address + offset, size);
+    pthread_mutex_unlock(&flash_mutex);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief The whole flash stays mapped, so mmap only hands out a pointer into it
+ */
+esp_err_t esp_partition_mmap(const esp_partition_t * partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void ** out_ptr,
+                             esp_partition_mmap_handle_t * out_handle)
+{
+    (void)memory;
+
+    esp_err_t err = check_range(partition, offset, size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    *out_ptr = p_flash + partition->address + offset;
+    *out_handle = partition->address + offset;
+
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+    (void)handle;
+}
+
+/* ------------------------------ esp_ota_ops ------------------------------ */
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &partition_table[FIRST_OTA_INDEX + running_slot];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+    return &partition_table[FIRST_OTA_INDEX + boot_slot];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t * start_from)
+{
+    int slot = slot_of((start_from != NULL) ? start_from : esp_ota_get_running_partition());
+    if (slot < 0)
+    {
+        return NULL;
+    }
+
+    return &partition_table[FIRST_OTA_INDEX + ((slot + 1) % OTA_SLOT_COUNT)];
+}
+
+esp_err_t esp_ota_begin(const esp_partition_t * partition, size_t image_size, esp_ota_handle_t * out_handle)
+{
+    if ((partition == NULL) || (out_handle == NULL) || (slot_of(partition) < 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (partition == esp_ota_get_running_partition())
+    {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+
+    size_t erase_size = 0;
+
+    if (image_size == OTA_SIZE_UNKNOWN)
+    {
+        erase_size = partition->size;
+    }
+    else if (image_size != OTA_WITH_SEQUENTIAL_WRITES)
+    {
+        if (image_size > partition->size)
+        {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        erase_size = ALIGN_UP(image_size, SPI_FLASH_SEC_SIZE);
+    }
+
+    if (erase_size > 0)
+    {
+        pthread_mutex_lock(&flash_mutex);
+        erase_locked(partition->address, erase_size);
+        pthread_mutex_unlock(&flash_mutex);
+    }
+
+    return open_handle(partition, erase_size, 0, out_handle);
+}
+
+esp_err_t esp_ota_resume(const esp_partition_t * partition, const size_t erase_size, const size_t image_offset,
+                         esp_ota_handle_t * out_handle)
+{
+    if ((partition == NULL) || (out_handle == NULL) || (slot_of(partition) < 0) || (image_offset > partition->size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (partition == esp_ota_get_running_partition())
+    {
+        return ESP_ERR_OTA_PARTITION_CONFLICT;
+    }
+
+    return open_handle(partition, MIN(ALIGN_UP(erase_size, SPI_FLASH_SEC_SIZE), partition->size), image_offset, out_handle);
+}
+
+esp_err_t esp_ota_write(esp_ota_handle_t handle, const void * data, size_t size)
+{
+    ota_handle_entry_t *p_entry = find_handle(handle);
+    if (p_entry == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return esp_ota_write_with_offset(handle, data, size, p_entry->wrote_size);
+}
+
+esp_err_t esp_ota_write_with_offset(esp_ota_handle_t handle, const void * data, size_t size, uint32_t offset)
+{
+    ota_handle_entry_t *p_entry = find_handle(handle);
+    if ((p_entry == NULL) || (data == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if ((offset == 0) && (size > 0) && (((const uint8_t *)data)[0] != IMAGE_HEADER_MAGIC))
+    {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    if ((offset + size) > p_entry->partition->size)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    pthread_mutex_lock(&flash_mutex);
+
+    /* Sequential writes erase sectors on demand, as app_update does */
+    size_t needed = ALIGN_UP(offset + size, SPI_FLASH_SEC_SIZE);
+    if (needed > p_entry->erased_size)
+    {
+        erase_locked(p_entry->partition->address + p_entry->erased_size, needed - p_entry->erased_size);
+        p_entry->erased_size = needed;
+    }
+
+    program_locked(p_entry->partition->address + offset, data, size);
+
+    pthread_mutex_unlock(&flash_mutex);
+
+    p_entry->wrote_size = MAX(p_entry->wrote_size, offset + size);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Release the handle and validate the image, which reads the whole image back as app_update does
+ */
+esp_err_t esp_ota_end(esp_ota_handle_t handle)
+{
+    ota_handle_entry_t *p_entry = find_handle(handle);
+    if (p_entry == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ota_timestamps.end_start_us = esp_timer_get_time();
+
+    p_entry->in_use = false;
+
+    pthread_mutex_lock(&flash_mutex);
+    stats.bytes_read += p_entry->wrote_size;
+    pthread_mutex_unlock(&flash_mutex);
+
+    esp_err_t err = ESP_OK;
+    if ((p_entry->wrote_size == 0) || (p_flash[p_entry->partition->address] != IMAGE_HEADER_MAGIC))
+    {
+        err = ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    ota_timestamps.end_done_us = esp_timer_get_time();
+
+    return err;
+}
+
+esp_err_t esp_ota_abort(esp_ota_handle_t handle)
+{
+    ota_handle_entry_t *p_entry = find_handle(handle);
+    if (p_entry == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    p_entry->in_use = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t * partition)
+{
+    int slot = slot_of(partition);
+    if (slot < 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (p_flash[partition->address] != IMAGE_HEADER_MAGIC)
+    {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+
+    ota_timestamps.set_boot_start_us = esp_timer_get_time();
+
+    pthread_mutex_lock(&flash_mutex);
+    boot_slot = (uint8_t)slot;
+    slot_states[slot] = ESP_OTA_IMG_NEW;
+    store_boot_slot_locked();
+    pthread_mutex_unlock(&flash_mutex);
+
+    ota_timestamps.set_boot_done_us = esp_timer_get_time();
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t * partition, esp_ota_img_states_t * out_state)
+{
+    int slot = slot_of(partition);
+    if ((slot < 0) || (out_state == NULL))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out_state = slot_states[slot];
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t * partition, esp_app_desc_t * app_desc)
+{
+    if (app_desc == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* The description is the start of the first segment */
+    esp_err_t err = esp_partition_read(partition, IMAGE_HEADER_SIZE + IMAGE_SEGMENT_HEADER_SIZE, app_desc, sizeof(*app_desc));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    return (app_desc->magic_word == ESP_APP_DESC_MAGIC_WORD) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    slot_states[running_slot] = ESP_OTA_IMG_VALID;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    slot_states[running_slot] = ESP_OTA_IMG_INVALID;
+    esp_restart();
+
+    return ESP_FAIL;
+}
+
+/* ---------------------------- esp_image_format ---------------------------- */
+
+/**
+ * @brief Walk the segment headers to find the image length, without the checksum and hash checks of the target
+ */
+esp_err_t esp_image_get_metadata(const esp_partition_pos_t * part, esp_image_metadata_t * metadata)
+{
+    if ((p_flash == NULL) || (part == NULL) || (metadata == NULL) ||
+        (part->offset > HOST_SIM_FLASH_SIZE_BYTES) || (part->size > (HOST_SIM_FLASH_SIZE_BYTES - part->offset)))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&flash_mutex);
+
+    const uint8_t *p_image = p_flash + part->offset;
+    uint8_t segment_count = p_image[1];
+    bool is_valid = (part->size >= IMAGE_HEADER_SIZE) && (p_image[0] == IMAGE_HEADER_MAGIC) &&
+                    (segment_count <= IMAGE_MAX_SEGMENTS);
+    uint32_t len = IMAGE_HEADER_SIZE;
+
+    for (uint8_t i = 0; is_valid && (i < segment_count); i++)
+    {
+        is_valid = (part->size - len) >= IMAGE_SEGMENT_HEADER_SIZE;
+        if (is_valid)
+        {
+            uint32_t data_len = 0;
+            memcpy(&data_len, p_image + len + 4U, sizeof(data_len));
+            len += IMAGE_SEGMENT_HEADER_SIZE;
+            is_valid = data_len <= (part->size - len);
+            len += data_len;
+        }
+    }
+
+    if (is_valid)
+    {
+        /* Checksum byte, padded to 16 bytes, then the optional SHA-256 */
+        len = ALIGN_UP(len + 1U, IMAGE_CHECKSUM_ALIGN) + ((p_image[IMAGE_HASH_APPENDED_OFFSET] == 1U) ? IMAGE_HASH_LEN : 0U);
+        is_valid = len <= part->size;
+    }
+
+    stats.bytes_read += len;
+    pthread_mutex_unlock(&flash_mutex);
+
+    if (!is_valid)
+    {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    metadata->start_addr = part->offset;
+    metadata->image_len = len;
+
+    return ESP_OK;
+}
+
+/* --------------------------------- Private -------------------------------- */
+
+static esp_err_t check_range(const esp_partition_t * partition, size_t offset, size_t size)
+{
+    if ((p_flash == NULL) || (partition == NULL))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if ((offset > partition->size) || (size > (partition->size - offset)))
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Erase sector aligned range, 64 KB aligned parts use the faster block erase
+ */
+static void erase_locked(uint32_t address, size_t size)
+{
+    uint64_t busy_us = 0;
+    uint32_t end = address + size;
+
+    while (address < end)
+    {
+        uint32_t len = SPI_FLASH_SEC_SIZE;
+
+        if (((address % FLASH_BLOCK_SIZE) == 0) && ((end - address) >= FLASH_BLOCK_SIZE))
+        {
+            len = FLASH_BLOCK_SIZE;
+            busy_us += latency.block_erase_us;
+        }
+        else
+        {
+            busy_us += latency.sector_erase_us;
+        }
+
+        memset(p_flash + address, 0xFF, len);
+        stats.sectors_erased += len / SPI_FLASH_SEC_SIZE;
+        address += len;
+    }
+
+    stats.busy_us += busy_us;
+    busy_wait(busy_us);
+}
+
+/**
+ * @brief Program bytes with NOR semantics: bits can only go from 1 to 0
+ */
+static void program_locked(uint32_t address, const void * src, size_t size)
+{
+    const uint8_t *p_src = src;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        p_flash[address + i] &= p_src[i];
+    }
+
+    if (size > 0)
+    {
+        uint32_t pages = ((address + size - 1U) / FLASH_PAGE_SIZE) - (address / FLASH_PAGE_SIZE) + 1U;
+        uint64_t busy_us = (uint64_t)pages * latency.page_program_us;
+
+        stats.bytes_programmed += size;
+        stats.busy_us += busy_us;
+        busy_wait(busy_us);
+    }
+}
+
+/**
+ * @brief The flash lock stays held while sleeping, as the SPI bus is busy on the real chip
+ */
+static void busy_wait(uint64_t us)
+{
+    if (us == 0)
+    {
+        return;
+    }
+
+    struct timespec delay = {
+        .tv_sec = (time_t)(us / 1000000U),
+        .tv_nsec = (long)((us % 1000000U) * 1000U)
+    };
+
+    while ((nanosleep(&delay, &delay) != 0) && (errno == EINTR))
+    {
+    }
+}
+
+static int slot_of(const esp_partition_t * partition)
+{
+    for (uint8_t i = 0; i < OTA_SLOT_COUNT; i++)
+    {
+        if (partition == &partition_table[FIRST_OTA_INDEX + i])
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static ota_handle_entry_t *find_handle(esp_ota_handle_t handle)
+{
+    for (uint8_t i = 0; i < MAX_OTA_HANDLES; i++)
+    {
+        if (ota_handles[i].in_use && (ota_handles[i].handle == handle))
+        {
+            return &ota_handles[i];
+        }
+    }
+
+    return NULL;
+}
+
+static esp_err_t open_handle(const esp_partition_t * partition, size_t erased_size, size_t wrote_size,
+                             esp_ota_handle_t * out_handle)
+{
+    for (uint8_t i = 0; i < MAX_OTA_HANDLES; i++)
+    {
+        if (!ota_handles[i].in_use)
+        {
+            ota_handles[i] = (ota_handle_entry_t) {
+                .in_use = true,
+                .handle = ++last_ota_handle,
+                .partition = partition,
+                .erased_size = erased_size,
+                .wrote_size = wrote_size
+            };
+
+            *out_handle = ota_handles[i].handle;
+
+            pthread_mutex_lock(&flash_mutex);
+            stats.ota_handles_opened++;
+            pthread_mutex_unlock(&flash_mutex);
+
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_NO_MEM;
+}
+
+/**
+ * @brief Persist the boot slot in the otadata partition, so the next run boots from it
+ */
+static void store_boot_slot_locked(void)
+{
+    uint32_t address = partition_table[OTADATA_INDEX].address;
+
+    erase_locked(address, SPI_FLASH_SEC_SIZE);
+    program_locked(address, &boot_slot, sizeof(boot_slot));
+}
@@ -0,0 +1,293 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+
+struct fake_task {
+    pthread_t thread;
+    TaskFunction_t task_code;
+    void * params;
+};
+
+struct fake_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t count;
+    UBaseType_t head;
+    uint8_t * p_storage;
+};
+
+
+static struct timespec start_time = {};
+static pthread_once_t start_time_once = PTHREAD_ONCE_INIT;
+
+
+static void *task_entry(void * arg);
+static void init_start_time(void);
+static bool wait_on(pthread_cond_t * p_cond, pthread_mutex_t * p_mutex, const struct timespec * p_deadline);
+static void deadline_from_ticks(TickType_t ticks, struct timespec * p_deadline);
+
+/**
+ * @brief Create a task as a detached thread. Priority and core affinity are ignored
+ */
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char * name, const uint32_t stack_depth,
+                                   void * params, UBaseType_t priority, TaskHandle_t * p_created_task,
+                                   const BaseType_t core_id)
+{
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core_id;
+
+    struct fake_task *p_task = calloc(1, sizeof(struct fake_task));
+    if (p_task == NULL)
+    {
+        return pdFAIL;
+    }
+
+    p_task->task_code = task_code;
+    p_task->params = params;
+
+    if (pthread_create(&p_task->thread, NULL, task_entry, p_task) != 0)
+    {
+        free(p_task);
+        return pdFAIL;
+    }
+
+    pthread_detach(p_task->thread);
+
+    if (p_created_task != NULL)
+    {
+        *p_created_task = p_task;
+    }
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char * name, const uint32_t stack_depth,
+                       void * params, UBaseType_t priority, TaskHandle_t * p_created_task)
+{
+    return xTaskCreatePinnedToCore(task_code, name, stack_depth, params, priority, p_created_task, tskNO_AFFINITY);
+}
+
+/**
+ * @brief Only self deletion is supported
+ */
+void vTaskDelete(TaskHandle_t task)
+{
+    (void)task;
+
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(const TickType_t ticks)
+{
+    struct timespec delay = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ)
+    };
+
+    while ((nanosleep(&delay, &delay) != 0) && (errno == EINTR))
+    {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    pthread_once(&start_time_once, init_start_time);
+
+    struct timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    int64_t elapsed_ms = ((int64_t)(now.tv_sec - start_time.tv_sec) * 1000) +
+                         ((now.tv_nsec - start_time.tv_nsec) / 1000000);
+
+    return (TickType_t)(elapsed_ms * configTICK_RATE_HZ / 1000);
+}
+
+QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t item_size)
+{
+    struct fake_queue *p_queue = calloc(1, sizeof(struct fake_queue));
+    if (p_queue == NULL)
+    {
+        return NULL;
+    }
+
+    if (item_size > 0)
+    {
+        p_queue->p_storage = calloc(length, item_size);
+        if (p_queue->p_storage == NULL)
+        {
+            free(p_queue);
+            return NULL;
+        }
+    }
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&p_queue->mutex, NULL);
+    pthread_cond_init(&p_queue->not_empty, &cond_attr);
+    pthread_cond_init(&p_queue->not_full, &cond_attr);
+
+    pthread_condattr_destroy(&cond_attr);
+
+    p_queue->length = length;
+    p_queue->item_size = item_size;
+
+    return p_queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void * p_item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = {};
+    deadline_from_ticks(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->count == queue->length)
+    {
+        if ((ticks_to_wait == 0) ||
+            !wait_on(&queue->not_full, &queue->mutex, (ticks_to_wait == portMAX_DELAY) ? NULL : &deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0)
+    {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->p_storage + (tail * queue->item_size), p_item, queue->item_size);
+    }
+
+    queue->count++;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void * p_buffer, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = {};
+    deadline_from_ticks(ticks_to_wait, &deadline);
+
+    pthread_mutex_lock(&queue->mutex);
+
+    while (queue->count == 0)
+    {
+        if ((ticks_to_wait == 0) ||
+            !wait_on(&queue->not_empty, &queue->mutex, (ticks_to_wait == portMAX_DELAY) ? NULL : &deadline))
+        {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFALSE;
+        }
+    }
+
+    if (queue->item_size > 0)
+    {
+        memcpy(p_buffer, queue->p_storage + (queue->head * queue->item_size), queue->item_size);
+    }
+
+    queue->head = (queue->head + 1U) % queue->length;
+    queue->count--;
+
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(const QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+
+    return count;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->count = 0;
+    queue->head = 0;
+    pthread_cond_broadcast(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue->p_storage);
+    free(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(const UBaseType_t max_count, const UBaseType_t initial_count)
+{
+    SemaphoreHandle_t semaphore = xQueueCreate(max_count, 0U);
+
+    if (semaphore != NULL)
+    {
+        semaphore->count = initial_count;
+    }
+
+    return semaphore;
+}
+
+static void *task_entry(void * arg)
+{
+    struct fake_task *p_task = arg;
+
+    p_task->task_code(p_task->params);
+
+    return NULL;
+}
+
+static void init_start_time(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+static bool wait_on(pthread_cond_t * p_cond, pthread_mutex_t * p_mutex, const struct timespec * p_deadline)
+{
+    if (p_deadline == NULL)
+    {
+        pthread_cond_wait(p_cond, p_mutex);
+        return true;
+    }
+
+    return (pthread_cond_timedwait(p_cond, p_mutex, p_deadline) != ETIMEDOUT);
+}
+
+static void deadline_from_ticks(TickType_t ticks, struct timespec * p_deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, p_deadline);
+
+    if ((ticks == 0) || (ticks == portMAX_DELAY))
+    {
+        return;
+    }
+
+    uint64_t ns = (uint64_t)p_deadline->tv_nsec + ((uint64_t)ticks * (1000000000ULL / configTICK_RATE_HZ));
+
+    p_deadline->tv_sec += (time_t)(ns / 1000000000ULL);
+    p_deadline->tv_nsec = (long)(ns % 1000000000ULL);
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "esp_system.h"
+#include "host_sim.h"
+
+/* The process wide allocator is replaced to count the heap in use, glibc supports this as long as
+ * the whole malloc family is provided. The actual allocation is left to glibc. */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void * ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void * ptr);
+
+
+static atomic_uint_fast64_t in_use_bytes = 0;
+static atomic_uint_fast64_t peak_bytes = 0;
+
+
+static void *track_alloc(void * ptr);
+static void track_free(void * ptr);
+
+void *malloc(size_t size)
+{
+    return track_alloc(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size)
+{
+    return track_alloc(__libc_calloc(count, size));
+}
+
+void *realloc(void * ptr, size_t size)
+{
+    size_t old_size = (ptr != NULL) ? malloc_usable_size(ptr) : 0;
+    void *new_ptr = __libc_realloc(ptr, size);
+
+    if ((new_ptr == NULL) && (size > 0))
+    {
+        return NULL;
+    }
+
+    atomic_fetch_sub(&in_use_bytes, old_size);
+
+    return track_alloc(new_ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return track_alloc(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void ** memptr, size_t alignment, size_t size)
+{
+    if ((alignment < sizeof(void *)) || ((alignment & (alignment - 1U)) != 0))
+    {
+        return EINVAL;
+    }
+
+    void *ptr = memalign(alignment, size);
+    if (ptr == NULL)
+    {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+
+    return 0;
+}
+
+void *valloc(size_t size)
+{
+    return memalign((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    return memalign(page_size, ((size + page_size - 1U) / page_size) * page_size);
+}
+
+void free(void * ptr)
+{
+    track_free(ptr);
+    __libc_free(ptr);
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    uint64_t used = atomic_load(&in_use_bytes);
+
+    return (used < HOST_SIM_HEAP_SIZE_BYTES) ? (uint32_t)(HOST_SIM_HEAP_SIZE_BYTES - used) : 0U;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    uint64_t peak = atomic_load(&peak_bytes);
+
+    return (peak < HOST_SIM_HEAP_SIZE_BYTES) ? (uint32_t)(HOST_SIM_HEAP_SIZE_BYTES - peak) : 0U;
+}
+
+void host_sim_heap_get_stats(host_sim_heap_stats_t * p_stats)
+{
+    p_stats->in_use_bytes = atomic_load(&in_use_bytes);
+    p_stats->peak_bytes = atomic_load(&peak_bytes);
+}
+
+void host_sim_heap_reset_peak(void)
+{
+    atomic_store(&peak_bytes, atomic_load(&in_use_bytes));
+}
+
+static void *track_alloc(void * ptr)
+{
+    if (ptr == NULL)
+    {
+        return NULL;
+    }
+
+    size_t size = malloc_usable_size(ptr);
+    uint64_t used = atomic_fetch_add(&in_use_bytes, size) + size;
+    uint64_t peak = atomic_load(&peak_bytes);
+
+    while ((used > peak) && !atomic_compare_exchange_weak(&peak_bytes, &peak, used))
+    {
+    }
+
+    return ptr;
+}
+
+static void track_free(void * ptr)
+{
+    if (ptr != NULL)
+    {
+        atomic_fetch_sub(&in_use_bytes, malloc_usable_size(ptr));
+    }
+}
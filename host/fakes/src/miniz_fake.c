@@ -0,0 +1,93 @@
+#include <string.h>
+#include <zlib.h>
+
+#include "rom/miniz.h"
+
+
+#define STATE_IDLE          (0U)
+#define STATE_INFLATING     (1U)
+#define STATE_DONE          (2U)
+#define STATE_FAILED        (3U)
+
+
+/**
+ * @brief Inflate as much as fits in the output buffer. The circular output buffer wraps like
+ * the ROM inflater does, but zlib keeps its own window so the data behind pOut_buf_next is not used
+ */
+tinfl_status tinfl_decompress(tinfl_decompressor * r, const mz_uint8 * pIn_buf_next, size_t * pIn_buf_size,
+                              mz_uint8 * pOut_buf_start, mz_uint8 * pOut_buf_next, size_t * pOut_buf_size,
+                              const mz_uint32 decomp_flags)
+{
+    (void)pOut_buf_start;
+
+    if ((r == NULL) || (pIn_buf_size == NULL) || (pOut_buf_size == NULL))
+    {
+        return TINFL_STATUS_BAD_PARAM;
+    }
+
+    if (r->m_state == STATE_DONE)
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_DONE;
+    }
+
+    if (r->m_state == STATE_FAILED)
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_FAILED;
+    }
+
+    if (r->m_state == STATE_IDLE)
+    {
+        memset(&r->stream, 0, sizeof(r->stream));
+
+        int window_bits = (decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER) ? MAX_WBITS : -MAX_WBITS;
+        if (inflateInit2(&r->stream, window_bits) != Z_OK)
+        {
+            return TINFL_STATUS_FAILED;
+        }
+
+        r->m_state = STATE_INFLATING;
+    }
+
+    size_t in_len = *pIn_buf_size;
+    size_t out_len = *pOut_buf_size;
+
+    r->stream.next_in = (Bytef *)pIn_buf_next;
+    r->stream.avail_in = (uInt)in_len;
+    r->stream.next_out = pOut_buf_next;
+    r->stream.avail_out = (uInt)out_len;
+
+    int ret = inflate(&r->stream, Z_NO_FLUSH);
+
+    *pIn_buf_size = in_len - r->stream.avail_in;
+    *pOut_buf_size = out_len - r->stream.avail_out;
+
+    if (ret == Z_STREAM_END)
+    {
+        inflateEnd(&r->stream);
+        r->m_state = STATE_DONE;
+        return TINFL_STATUS_DONE;
+    }
+
+    if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+    {
+        inflateEnd(&r->stream);
+        r->m_state = STATE_FAILED;
+        return TINFL_STATUS_FAILED;
+    }
+
+    if (r->stream.avail_out == 0)
+    {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+
+    if (!(decomp_flags & TINFL_FLAG_HAS_MORE_INPUT))
+    {
+        return TINFL_STATUS_FAILED;
+    }
+
+    return TINFL_STATUS_NEEDS_MORE_INPUT;
+}
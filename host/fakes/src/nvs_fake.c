@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+
+#define NVS_KEY_NAME_MAX_SIZE       (16U)
+#define MAX_NAMESPACES              (8U)
+#define MAX_ENTRIES                 (32U)
+#define MAX_HANDLES                 (8U)
+
+
+typedef enum {
+    ENTRY_TYPE_U32,
+    ENTRY_TYPE_BLOB
+} nvs_entry_type_e;
+
+typedef struct {
+    bool in_use;
+    uint8_t ns_index;
+    nvs_entry_type_e type;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t *p_data;
+    size_t len;
+} nvs_entry_t;
+
+typedef struct {
+    bool in_use;
+    uint8_t ns_index;
+    nvs_open_mode_t mode;
+} nvs_handle_entry_t;
+
+
+static pthread_mutex_t nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool is_initialized = false;
+
+static char namespaces[MAX_NAMESPACES][NVS_KEY_NAME_MAX_SIZE] = {};
+static uint8_t namespace_count = 0;
+static nvs_entry_t entries[MAX_ENTRIES] = {};
+static nvs_handle_entry_t handles[MAX_HANDLES] = {};
+
+
+static nvs_handle_entry_t *get_handle(nvs_handle_t handle);
+static nvs_entry_t *find_entry(uint8_t ns_index, const char * key);
+static esp_err_t set_entry(nvs_handle_t handle, const char * key, nvs_entry_type_e type, const void * value, size_t length);
+static esp_err_t get_entry(nvs_handle_t handle, const char * key, nvs_entry_type_e type, const nvs_entry_t ** pp_entry);
+static void free_entry(nvs_entry_t * p_entry);
+
+esp_err_t nvs_flash_init(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    is_initialized = true;
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvs_mutex);
+
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++)
+    {
+        free_entry(&entries[i]);
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief Open a namespace, as on the target a read only open fails when it was never written
+ */
+esp_err_t nvs_open(const char * namespace_name, nvs_open_mode_t open_mode, nvs_handle_t * out_handle)
+{
+    if ((namespace_name == NULL) || (out_handle == NULL) || (strlen(namespace_name) >= NVS_KEY_NAME_MAX_SIZE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    uint8_t ns_index = 0;
+    while ((ns_index < namespace_count) && (strcmp(namespaces[ns_index], namespace_name) != 0))
+    {
+        ns_index++;
+    }
+
+    if (!is_initialized)
+    {
+        err = ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    else if (ns_index == namespace_count)
+    {
+        if (open_mode == NVS_READONLY)
+        {
+            err = ESP_ERR_NVS_NOT_FOUND;
+        }
+        else if (namespace_count == MAX_NAMESPACES)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+        else
+        {
+            strcpy(namespaces[namespace_count++], namespace_name);
+        }
+    }
+
+    if (err == ESP_OK)
+    {
+        err = ESP_ERR_NO_MEM;
+
+        for (uint8_t i = 0; i < MAX_HANDLES; i++)
+        {
+            if (!handles[i].in_use)
+            {
+                handles[i] = (nvs_handle_entry_t) { .in_use = true, .ns_index = ns_index, .mode = open_mode };
+                *out_handle = i + 1U;
+                err = ESP_OK;
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_mutex);
+
+    nvs_handle_entry_t *p_handle = get_handle(handle);
+    if (p_handle != NULL)
+    {
+        p_handle->in_use = false;
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+}
+
+/**
+ * @brief Read a blob, a NULL output only queries its length
+ */
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char * key, void * out_value, size_t * length)
+{
+    if (length == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    const nvs_entry_t *p_entry = NULL;
+    esp_err_t err = get_entry(handle, key, ENTRY_TYPE_BLOB, &p_entry);
+
+    if (err == ESP_OK)
+    {
+        if (out_value == NULL)
+        {
+            *length = p_entry->len;
+        }
+        else if (*length < p_entry->len)
+        {
+            *length = p_entry->len;
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        else
+        {
+            memcpy(out_value, p_entry->p_data, p_entry->len);
+            *length = p_entry->len;
+        }
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char * key, const void * value, size_t length)
+{
+    return set_entry(handle, key, ENTRY_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char * key, uint32_t * out_value)
+{
+    if (out_value == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    const nvs_entry_t *p_entry = NULL;
+    esp_err_t err = get_entry(handle, key, ENTRY_TYPE_U32, &p_entry);
+
+    if (err == ESP_OK)
+    {
+        memcpy(out_value, p_entry->p_data, sizeof(uint32_t));
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char * key, uint32_t value)
+{
+    return set_entry(handle, key, ENTRY_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char * key)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    nvs_handle_entry_t *p_handle = get_handle(handle);
+    nvs_entry_t *p_entry = (p_handle != NULL) ? find_entry(p_handle->ns_index, key) : NULL;
+
+    if (p_handle == NULL)
+    {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    else if (p_handle->mode == NVS_READONLY)
+    {
+        err = ESP_ERR_NVS_READ_ONLY;
+    }
+    else if (p_entry == NULL)
+    {
+        err = ESP_ERR_NVS_NOT_FOUND;
+    }
+    else
+    {
+        free_entry(p_entry);
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    nvs_handle_entry_t *p_handle = get_handle(handle);
+
+    if (p_handle == NULL)
+    {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    else if (p_handle->mode == NVS_READONLY)
+    {
+        err = ESP_ERR_NVS_READ_ONLY;
+    }
+    else
+    {
+        for (uint8_t i = 0; i < MAX_ENTRIES; i++)
+        {
+            if (entries[i].in_use && (entries[i].ns_index == p_handle->ns_index))
+            {
+                free_entry(&entries[i]);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+/**
+ * @brief Values are kept in RAM, committing has nothing to flush
+ */
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    pthread_mutex_lock(&nvs_mutex);
+    esp_err_t err = (get_handle(handle) != NULL) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+static nvs_handle_entry_t *get_handle(nvs_handle_t handle)
+{
+    if ((handle == 0) || (handle > MAX_HANDLES) || !handles[handle - 1U].in_use)
+    {
+        return NULL;
+    }
+
+    return &handles[handle - 1U];
+}
+
+static nvs_entry_t *find_entry(uint8_t ns_index, const char * key)
+{
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++)
+    {
+        if (entries[i].in_use && (entries[i].ns_index == ns_index) && (strcmp(entries[i].key, key) == 0))
+        {
+            return &entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static esp_err_t set_entry(nvs_handle_t handle, const char * key, nvs_entry_type_e type, const void * value, size_t length)
+{
+    if ((key == NULL) || (value == NULL) || (strlen(key) >= NVS_KEY_NAME_MAX_SIZE))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t *p_data = malloc((length > 0) ? length : 1U);
+    if (p_data == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(p_data, value, length);
+
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_mutex);
+
+    nvs_handle_entry_t *p_handle = get_handle(handle);
+    nvs_entry_t *p_entry = NULL;
+
+    if (p_handle == NULL)
+    {
+        err = ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    else if (p_handle->mode == NVS_READONLY)
+    {
+        err = ESP_ERR_NVS_READ_ONLY;
+    }
+    else
+    {
+        p_entry = find_entry(p_handle->ns_index, key);
+
+        for (uint8_t i = 0; (p_entry == NULL) && (i < MAX_ENTRIES); i++)
+        {
+            if (!entries[i].in_use)
+            {
+                p_entry = &entries[i];
+            }
+        }
+
+        if (p_entry == NULL)
+        {
+            err = ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (err == ESP_OK)
+    {
+        free_entry(p_entry);
+
+        p_entry->in_use = true;
+        p_entry->ns_index = p_handle->ns_index;
+        p_entry->type = type;
+        strcpy(p_entry->key, key);
+        p_entry->p_data = p_data;
+        p_entry->len = length;
+    }
+    else
+    {
+        free(p_data);
+    }
+
+    pthread_mutex_unlock(&nvs_mutex);
+
+    return err;
+}
+
+static esp_err_t get_entry(nvs_handle_t handle, const char * key, nvs_entry_type_e type, const nvs_entry_t ** pp_entry)
+{
+    nvs_handle_entry_t *p_handle = get_handle(handle);
+    if (p_handle == NULL)
+    {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+
+    if (key == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const nvs_entry_t *p_entry = find_entry(p_handle->ns_index, key);
+    if ((p_entry == NULL) || (p_entry->type != type))
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *pp_entry = p_entry;
+
+    return ESP_OK;
+}
+
+static void free_entry(nvs_entry_t * p_entry)
+{
+    free(p_entry->p_data);
+    memset(p_entry, 0, sizeof(nvs_entry_t));
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+#include "mbedtls/sha256.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "host_sim.h"
+#include "msg_parser.h"
+#include "ota_hash_cache.h"
+#include "sys_feedback.h"
+
+
+/* Client side of the protocol handled by msg_parser */
+#define LEGACY_HEADER_SIZE_IN_BYTES     (36U)
+#define EXT_HEADER_MAGIC                (0x5841544FU)
+#define EXT_HEADER_VERSION              (1U)
+#define EXT_HEADER_TYPE_OTA_BEGIN       (0x01U)
+#define EXT_FLAG_COMPRESSED             (1U << 2)
+#define EXT_HEADER_SIZE_IN_BYTES        (8U + 2U + LEGACY_HEADER_SIZE_IN_BYTES + 4U)
+
+#define HASH_SIZE_IN_BYTES              (32U)
+#define IMAGE_HEADER_MAGIC              (0xE9U)
+#define IMAGE_SIZE_BYTES                (64U * 1024U)
+#define CHUNK_LEN_BYTES                 (2048U) /* TCP_BUFFER_LEN_BYTES of tcp_tls */
+#define FLASH_PATH                      "msg_parser_discard_test_flash.bin"
+
+
+static uint8_t *build_image(void);
+static uint16_t build_header(const uint32_t size, const uint32_t stream_size, const uint8_t * p_hash, uint8_t * p_out);
+static void put_u32_le(uint8_t * p_data, const uint32_t value);
+
+/**
+ * @brief Send a compressed stream whose zlib header is corrupt, then the rest of it. The transfer fails on
+ * the first read, the tail must be dropped rather than parsed as a new header, even when it looks like one
+ */
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    msg_parser_session_t *p_session = NULL;
+    if ((nvs_flash_init() != ESP_OK) || (host_sim_flash_init(FLASH_PATH) != ESP_OK) ||
+        (sys_feedback_init() != ERR_CODE_OK) || (ota_hash_cache_init() != ERR_CODE_OK) ||
+        (msg_parser_init() != ERR_CODE_OK) || (msg_parser_open_session(&p_session) != ERR_CODE_OK))
+    {
+        fprintf(stderr, "Failed to initialize the components\n");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t *p_image = build_image();
+    uLongf stream_size = compressBound(IMAGE_SIZE_BYTES);
+    uint8_t *p_stream = malloc(stream_size);
+    if ((p_image == NULL) || (p_stream == NULL) ||
+        (compress2(p_stream, &stream_size, p_image, IMAGE_SIZE_BYTES, Z_BEST_SPEED) != Z_OK) ||
+        (stream_size <= (CHUNK_LEN_BYTES + LEGACY_HEADER_SIZE_IN_BYTES)))
+    {
+        fprintf(stderr, "Failed to build the stream\n");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t hash[HASH_SIZE_IN_BYTES] = {};
+    mbedtls_sha256(p_image, IMAGE_SIZE_BYTES, hash, 0);
+
+    /* Corrupt zlib header, and a tail starting with a legacy header of the same image */
+    p_stream[0] = 0;
+    p_stream[1] = 0;
+    put_u32_le(p_stream + CHUNK_LEN_BYTES, IMAGE_SIZE_BYTES);
+    memcpy(p_stream + CHUNK_LEN_BYTES + 4U, hash, HASH_SIZE_IN_BYTES);
+
+    uint8_t header[EXT_HEADER_SIZE_IN_BYTES] = {};
+    uint16_t header_len = build_header(IMAGE_SIZE_BYTES, (uint32_t)stream_size, hash, header);
+    uint32_t bytes_read = 0;
+
+    host_sim_flash_reset_stats();
+
+    bool is_passed = true;
+    if (msg_parser_run(p_session, header, header_len, &bytes_read) != ERR_CODE_IN_PROGRESS)
+    {
+        fprintf(stderr, "OTA begin rejected\n");
+        is_passed = false;
+    }
+
+    if (is_passed && (msg_parser_run(p_session, p_stream, CHUNK_LEN_BYTES, &bytes_read) != ERR_CODE_FAIL))
+    {
+        fprintf(stderr, "Corrupt stream accepted\n");
+        is_passed = false;
+    }
+
+    host_sim_flash_stats_t failed_stats = {};
+    host_sim_flash_get_stats(&failed_stats);
+
+    for (size_t offset = CHUNK_LEN_BYTES; is_passed && (offset < stream_size); offset += CHUNK_LEN_BYTES)
+    {
+        uint16_t len = (uint16_t)(((stream_size - offset) < CHUNK_LEN_BYTES) ? (stream_size - offset) : CHUNK_LEN_BYTES);
+        msg_parser_run(p_session, p_stream + offset, len, &bytes_read);
+    }
+
+    host_sim_flash_stats_t stats = {};
+    host_sim_flash_get_stats(&stats);
+
+    if (is_passed && (stats.ota_handles_opened != 1U))
+    {
+        fprintf(stderr, "Tail started %u more update(s)\n", (unsigned)(stats.ota_handles_opened - 1U));
+        is_passed = false;
+    }
+
+    if (is_passed && (msg_parser_is_updating(p_session) || (stats.bytes_programmed != failed_stats.bytes_programmed)))
+    {
+        fprintf(stderr, "Tail written to flash\n");
+        is_passed = false;
+    }
+
+    printf("%s\n", is_passed ? "PASS" : "FAIL");
+
+    msg_parser_close_session(p_session);
+    free(p_stream);
+    free(p_image);
+    host_sim_flash_deinit();
+    remove(FLASH_PATH);
+
+    return is_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint8_t *build_image(void)
+{
+    uint8_t *p_image = malloc(IMAGE_SIZE_BYTES);
+    if (p_image == NULL)
+    {
+        return NULL;
+    }
+
+    uint32_t state = 0x2545F491U;
+    for (size_t i = 0; i < IMAGE_SIZE_BYTES; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        p_image[i] = (uint8_t)state;
+    }
+
+    p_image[0] = IMAGE_HEADER_MAGIC;
+
+    return p_image;
+}
+
+/**
+ * @brief Build an extended OTA begin announcing a compressed stream of stream_size bytes
+ */
+static uint16_t build_header(const uint32_t size, const uint32_t stream_size, const uint8_t * p_hash, uint8_t * p_out)
+{
+    uint16_t payload_len = EXT_HEADER_SIZE_IN_BYTES - 8U;
+    uint8_t *p_legacy = p_out + 10U;
+
+    put_u32_le(p_out, EXT_HEADER_MAGIC);
+    p_out[4] = EXT_HEADER_VERSION;
+    p_out[5] = EXT_HEADER_TYPE_OTA_BEGIN;
+    p_out[6] = (uint8_t)payload_len;
+    p_out[7] = (uint8_t)(payload_len >> 8U);
+    p_out[8] = (uint8_t)EXT_FLAG_COMPRESSED;
+    p_out[9] = 0;
+
+    put_u32_le(p_legacy, size);
+    memcpy(p_legacy + 4U, p_hash, HASH_SIZE_IN_BYTES);
+    put_u32_le(p_legacy + LEGACY_HEADER_SIZE_IN_BYTES, stream_size);
+
+    return EXT_HEADER_SIZE_IN_BYTES;
+}
+
+static void put_u32_le(uint8_t * p_data, const uint32_t value)
+{
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        p_data[i] = (uint8_t)(value >> (8U * i));
+    }
+}
@@ -0,0 +1,521 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <getopt.h>
+
+#include "mbedtls/sha256.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "host_sim.h"
+#include "msg_parser.h"
+#include "ota_blocks.h"
+#include "ota_hash_cache.h"
+#include "ota_metrics.h"
+#include "sys_feedback.h"
+
+
+/* Client side of the protocol handled by msg_parser */
+#define LEGACY_HEADER_SIZE_IN_BYTES     (36U)
+#define EXT_HEADER_MAGIC                (0x5841544FU)
+#define EXT_HEADER_VERSION              (1U)
+#define EXT_HEADER_TYPE_OTA_BEGIN       (0x01U)
+#define EXT_HEADER_TYPE_STATUS_QUERY    (0x02U)
+#define EXT_FLAG_WINDOWED               (1U << 0)
+#define EXT_FLAG_BLOCKS                 (1U << 7)
+#define EXT_HEADER_SIZE_IN_BYTES        (8U + 2U + LEGACY_HEADER_SIZE_IN_BYTES + 4U)
+#define BEGIN_ACK_TYPE                  (0x81U)
+#define STATUS_ACK_TYPE                 (0x83U)
+#define BLOCKS_ACK_TYPE                 (0x84U)
+#define EXT_ACK_MARKER                  (0xA5U)
+#define EXT_ACK_PREFIX_SIZE_IN_BYTES    (4U)
+
+#define HASH_SIZE_IN_BYTES              (32U)
+#define IMAGE_HEADER_MAGIC              (0xE9U)
+#define DEFAULT_CHUNK_LEN_BYTES         (2048U) /* TCP_BUFFER_LEN_BYTES of tcp_tls */
+#define DEFAULT_SYNTHETIC_SIZE_BYTES    (1024U * 1024U)
+
+
+typedef struct {
+    const char *flash_path;
+    const char *image_path;
+    size_t synthetic_size;
+    size_t chunk_len;
+    bool is_extended;
+    bool is_blocks;
+    bool has_latency;
+} run_options_t;
+
+typedef struct {
+    bool is_received;
+    uint32_t needed_len;
+    uint8_t bitmap[OTA_BLOCKS_BITMAP_MAX_LEN];
+} block_plan_t;
+
+
+static bool parse_options(int argc, char ** argv, run_options_t * p_options);
+static uint8_t *load_image(const run_options_t * p_options, size_t * p_out_size);
+static uint16_t build_header(const run_options_t * p_options, const size_t size, const uint8_t * p_hash, uint8_t * p_out);
+static bool send_header(msg_parser_session_t * p_session, const uint8_t * p_header, const uint16_t len, const bool is_extended);
+static types_error_code_e send_stream(msg_parser_session_t * p_session, const uint8_t * p_data, const size_t size, const size_t chunk_len, block_plan_t * p_plan);
+static types_error_code_e send_blocks(msg_parser_session_t * p_session, const uint8_t * p_image, const size_t size, const size_t chunk_len);
+static void read_block_plan(const uint8_t * p_ack, const uint8_t len, block_plan_t * p_plan);
+static void print_metrics(msg_parser_session_t * p_session);
+static void put_u32_le(uint8_t * p_data, const uint32_t value);
+static uint32_t get_u32_le(const uint8_t * p_data);
+static void print_usage(const char * name);
+
+/**
+ * @brief Push an image through msg_parser against the simulated flash, then report the throughput
+ */
+int main(int argc, char ** argv)
+{
+    run_options_t options = {
+        .flash_path = "ota_flash.bin",
+        .image_path = NULL,
+        .synthetic_size = DEFAULT_SYNTHETIC_SIZE_BYTES,
+        .chunk_len = DEFAULT_CHUNK_LEN_BYTES,
+        .is_extended = false,
+        .is_blocks = false,
+        .has_latency = false
+    };
+
+    if (!parse_options(argc, argv, &options))
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    if ((nvs_flash_init() != ESP_OK) || (host_sim_flash_init(options.flash_path) != ESP_OK))
+    {
+        fprintf(stderr, "Failed to initialize the simulated flash %s\n", options.flash_path);
+        return EXIT_FAILURE;
+    }
+
+    host_sim_flash_latency_t latency = HOST_SIM_FLASH_LATENCY_TYPICAL;
+    host_sim_flash_latency_t no_latency = HOST_SIM_FLASH_LATENCY_NONE;
+    host_sim_flash_set_latency(options.has_latency ? &latency : &no_latency);
+
+    msg_parser_session_t *p_session = NULL;
+    if ((sys_feedback_init() != ERR_CODE_OK) || (ota_hash_cache_init() != ERR_CODE_OK) ||
+        (msg_parser_init() != ERR_CODE_OK) || (msg_parser_open_session(&p_session) != ERR_CODE_OK))
+    {
+        fprintf(stderr, "Failed to initialize the components\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t size = 0;
+    uint8_t *p_image = load_image(&options, &size);
+    if (p_image == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    uint8_t hash[HASH_SIZE_IN_BYTES] = {};
+    mbedtls_sha256(p_image, size, hash, 0);
+
+    uint8_t header[EXT_HEADER_SIZE_IN_BYTES] = {};
+    uint16_t header_len = build_header(&options, size, hash, header);
+
+    printf("Running partition: %s\n", esp_ota_get_running_partition()->label);
+
+    host_sim_flash_reset_stats();
+    int64_t start_us = esp_timer_get_time();
+
+    types_error_code_e err = ERR_CODE_FAIL;
+    if (send_header(p_session, header, header_len, options.is_extended))
+    {
+        err = options.is_blocks ? send_blocks(p_session, p_image, size, options.chunk_len) :
+                                  send_stream(p_session, p_image, size, options.chunk_len, NULL);
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    host_sim_flash_stats_t stats = {};
+    host_sim_flash_get_stats(&stats);
+
+    double elapsed_s = (double)elapsed_us / 1e6;
+
+    printf("Result: %s\n", (err == ERR_CODE_OK) ? "OK" : "FAIL");
+    printf("Image: %zu bytes in %.3f s, %.1f KB/s\n", size, elapsed_s,
+           (elapsed_s > 0.0) ? ((double)size / 1024.0) / elapsed_s : 0.0);
+    printf("Flash: %llu bytes programmed, %u sectors erased, %llu bytes read, %.3f s busy\n",
+           (unsigned long long)stats.bytes_programmed, stats.sectors_erased,
+           (unsigned long long)stats.bytes_read, (double)stats.busy_us / 1e6);
+    printf("Boot partition: %s\n", esp_ota_get_boot_partition()->label);
+
+    print_metrics(p_session);
+
+    msg_parser_close_session(p_session);
+    free(p_image);
+    host_sim_flash_deinit();
+
+    return (err == ERR_CODE_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool parse_options(int argc, char ** argv, run_options_t * p_options)
+{
+    int opt = 0;
+
+    while ((opt = getopt(argc, argv, "f:i:s:c:xbl")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                p_options->flash_path = optarg;
+            break;
+
+            case 'i':
+                p_options->image_path = optarg;
+            break;
+
+            case 's':
+                p_options->synthetic_size = strtoul(optarg, NULL, 0);
+            break;
+
+            case 'c':
+                p_options->chunk_len = strtoul(optarg, NULL, 0);
+            break;
+
+            case 'x':
+                p_options->is_extended = true;
+            break;
+
+            case 'b':
+                p_options->is_extended = true;
+                p_options->is_blocks = true;
+            break;
+
+            case 'l':
+                p_options->has_latency = true;
+            break;
+
+            default:
+            return false;
+        }
+    }
+
+    return (p_options->chunk_len > 0) && (p_options->chunk_len <= UINT16_MAX) && (p_options->synthetic_size > 0) &&
+           (!p_options->is_blocks || (p_options->synthetic_size <= (OTA_BLOCKS_MAX_COUNT * OTA_BLOCKS_BLOCK_LEN_BYTES)));
+}
+
+/**
+ * @brief Read the image file, or generate a pseudo random image starting with the app image magic
+ */
+static uint8_t *load_image(const run_options_t * p_options, size_t * p_out_size)
+{
+    if (p_options->image_path == NULL)
+    {
+        uint8_t *p_image = malloc(p_options->synthetic_size);
+        if (p_image == NULL)
+        {
+            return NULL;
+        }
+
+        uint32_t state = 0x2545F491U;
+        for (size_t i = 0; i < p_options->synthetic_size; i++)
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            p_image[i] = (uint8_t)state;
+        }
+
+        p_image[0] = IMAGE_HEADER_MAGIC;
+        *p_out_size = p_options->synthetic_size;
+
+        return p_image;
+    }
+
+    FILE *p_file = fopen(p_options->image_path, "rb");
+    if (p_file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", p_options->image_path);
+        return NULL;
+    }
+
+    fseek(p_file, 0, SEEK_END);
+    long size = ftell(p_file);
+    fseek(p_file, 0, SEEK_SET);
+
+    uint8_t *p_image = (size > 0) ? malloc((size_t)size) : NULL;
+    if ((p_image == NULL) || (fread(p_image, 1, (size_t)size, p_file) != (size_t)size))
+    {
+        fprintf(stderr, "Failed to read %s\n", p_options->image_path);
+        free(p_image);
+        p_image = NULL;
+    }
+
+    fclose(p_file);
+    *p_out_size = (size_t)size;
+
+    return p_image;
+}
+
+/**
+ * @brief Build the legacy header, or an extended OTA begin asking for the largest ack window, and for
+ * the block exchange with -b
+ */
+static uint16_t build_header(const run_options_t * p_options, const size_t size, const uint8_t * p_hash, uint8_t * p_out)
+{
+    uint8_t *p_legacy = p_out;
+
+    if (p_options->is_extended)
+    {
+        uint16_t payload_len = EXT_HEADER_SIZE_IN_BYTES - 8U;
+
+        put_u32_le(p_out, EXT_HEADER_MAGIC);
+        p_out[4] = EXT_HEADER_VERSION;
+        p_out[5] = EXT_HEADER_TYPE_OTA_BEGIN;
+        p_out[6] = (uint8_t)payload_len;
+        p_out[7] = (uint8_t)(payload_len >> 8U);
+        p_out[8] = (uint8_t)(EXT_FLAG_WINDOWED | (p_options->is_blocks ? EXT_FLAG_BLOCKS : 0U));
+        p_out[9] = 0;
+        p_legacy = p_out + 10U;
+
+        put_u32_le(p_legacy + LEGACY_HEADER_SIZE_IN_BYTES, 0);
+    }
+
+    put_u32_le(p_legacy, (uint32_t)size);
+    memcpy(p_legacy + 4U, p_hash, HASH_SIZE_IN_BYTES);
+
+    return p_options->is_extended ? EXT_HEADER_SIZE_IN_BYTES : LEGACY_HEADER_SIZE_IN_BYTES;
+}
+
+static bool send_header(msg_parser_session_t * p_session, const uint8_t * p_header, const uint16_t len, const bool is_extended)
+{
+    uint32_t bytes_read = 0;
+
+    if (msg_parser_run(p_session, p_header, len, &bytes_read) != ERR_CODE_IN_PROGRESS)
+    {
+        fprintf(stderr, "Header rejected\n");
+        return false;
+    }
+
+    uint8_t ack[MSG_PARSER_BUF_LEN_BYTES] = {};
+    uint8_t ack_len = 0;
+    msg_parser_build_rx_ack(p_session, ack, sizeof(ack), &ack_len);
+
+    if (is_extended && ((ack_len < 5U) || (ack[1] != BEGIN_ACK_TYPE) || (ack[4] != 0U)))
+    {
+        fprintf(stderr, "OTA begin rejected\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Feed the stream in chunk_len pieces, the way tcp_tls hands over each TLS read, and pick the
+ * blocks ack from the acks when p_plan is given
+ */
+static types_error_code_e send_stream(msg_parser_session_t * p_session, const uint8_t * p_data, const size_t size, const size_t chunk_len, block_plan_t * p_plan)
+{
+    types_error_code_e err = ERR_CODE_IN_PROGRESS;
+    size_t offset = 0;
+
+    while ((err == ERR_CODE_IN_PROGRESS) && (offset < size))
+    {
+        uint16_t len = (uint16_t)(((size - offset) < chunk_len) ? (size - offset) : chunk_len);
+        uint32_t bytes_read = 0;
+
+        err = msg_parser_run(p_session, p_data + offset, len, &bytes_read);
+        offset += len;
+
+        uint8_t ack[MSG_PARSER_BUF_LEN_BYTES] = {};
+        uint8_t ack_len = 0;
+        msg_parser_build_rx_ack(p_session, ack, sizeof(ack), &ack_len);
+
+        if (p_plan != NULL)
+        {
+            read_block_plan(ack, ack_len, p_plan);
+        }
+    }
+
+    return err;
+}
+
+/**
+ * @brief Send the hash list of the image blocks, then only the blocks requested by the blocks ack
+ */
+static types_error_code_e send_blocks(msg_parser_session_t * p_session, const uint8_t * p_image, const size_t size, const size_t chunk_len)
+{
+    uint32_t count = OTA_BLOCKS_COUNT(size);
+    uint8_t *p_list = malloc(count * OTA_BLOCKS_HASH_LEN);
+    uint8_t *p_needed = malloc(size);
+    block_plan_t plan = {};
+    size_t needed_len = 0;
+    uint32_t needed_count = 0;
+
+    if ((p_list == NULL) || (p_needed == NULL))
+    {
+        free(p_list);
+        free(p_needed);
+        return ERR_CODE_FAIL;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t offset = (size_t)i * OTA_BLOCKS_BLOCK_LEN_BYTES;
+        size_t len = ((size - offset) < OTA_BLOCKS_BLOCK_LEN_BYTES) ? (size - offset) : OTA_BLOCKS_BLOCK_LEN_BYTES;
+        uint8_t hash[HASH_SIZE_IN_BYTES] = {};
+
+        mbedtls_sha256(p_image + offset, len, hash, 0);
+        memcpy(p_list + (i * OTA_BLOCKS_HASH_LEN), hash, OTA_BLOCKS_HASH_LEN);
+    }
+
+    types_error_code_e err = send_stream(p_session, p_list, count * OTA_BLOCKS_HASH_LEN, chunk_len, &plan);
+
+    if (!plan.is_received && (err == ERR_CODE_IN_PROGRESS))
+    {
+        fprintf(stderr, "No blocks ack after the hash list\n");
+        err = ERR_CODE_FAIL;
+    }
+
+    for (uint32_t i = 0; plan.is_received && (i < count); i++)
+    {
+        if ((plan.bitmap[i / 8U] & (1U << (i % 8U))) != 0)
+        {
+            size_t offset = (size_t)i * OTA_BLOCKS_BLOCK_LEN_BYTES;
+            size_t len = ((size - offset) < OTA_BLOCKS_BLOCK_LEN_BYTES) ? (size - offset) : OTA_BLOCKS_BLOCK_LEN_BYTES;
+
+            memcpy(p_needed + needed_len, p_image + offset, len);
+            needed_len += len;
+            needed_count++;
+        }
+    }
+
+    if (plan.is_received)
+    {
+        printf("Blocks: %u of %u requested, %zu bytes\n", needed_count, count, needed_len);
+    }
+
+    if ((err == ERR_CODE_IN_PROGRESS) && (needed_len != plan.needed_len))
+    {
+        fprintf(stderr, "Blocks ack announces %u bytes, the bitmap %zu\n", plan.needed_len, needed_len);
+        err = ERR_CODE_FAIL;
+    }
+
+    if (err == ERR_CODE_IN_PROGRESS)
+    {
+        err = send_stream(p_session, p_needed, needed_len, chunk_len, NULL);
+    }
+
+    free(p_list);
+    free(p_needed);
+
+    return err;
+}
+
+/**
+ * @brief Look for a blocks ack among the ack frames of a read
+ */
+static void read_block_plan(const uint8_t * p_ack, const uint8_t len, block_plan_t * p_plan)
+{
+    uint16_t offset = 0;
+
+    while ((offset + EXT_ACK_PREFIX_SIZE_IN_BYTES) <= len)
+    {
+        uint16_t payload_len = (uint16_t)(p_ack[offset + 2U] | (p_ack[offset + 3U] << 8U));
+        const uint8_t *p_payload = p_ack + offset + EXT_ACK_PREFIX_SIZE_IN_BYTES;
+
+        if ((p_ack[offset] == EXT_ACK_MARKER) && (p_ack[offset + 1U] == BLOCKS_ACK_TYPE) &&
+            (payload_len >= 4U) && ((payload_len - 4U) <= sizeof(p_plan->bitmap)))
+        {
+            p_plan->needed_len = get_u32_le(p_payload);
+            memcpy(p_plan->bitmap, p_payload + 4U, payload_len - 4U);
+            p_plan->is_received = true;
+        }
+
+        offset += EXT_ACK_PREFIX_SIZE_IN_BYTES + payload_len;
+    }
+}
+
+/**
+ * @brief Ask msg_parser for the timings of the update with a status query and print them
+ */
+static void print_metrics(msg_parser_session_t * p_session)
+{
+    static const char *phase_names[OTA_METRICS_PHASE_COUNT] = {
+        "handshake", "hmac", "header", "ota_begin", "write", "sha", "ota_end", "set_boot", "readback"
+    };
+    static const char *bucket_names[OTA_METRICS_WRITE_HIST_BUCKETS] = {
+        "<250us", "<500us", "<1ms", "<2ms", "<5ms", "<10ms", "<50ms", ">=50ms"
+    };
+
+    uint8_t query[8] = {};
+    put_u32_le(query, EXT_HEADER_MAGIC);
+    query[4] = EXT_HEADER_VERSION;
+    query[5] = EXT_HEADER_TYPE_STATUS_QUERY;
+
+    uint32_t bytes_read = 0;
+    msg_parser_run(p_session, query, sizeof(query), &bytes_read);
+
+    uint8_t ack[MSG_PARSER_BUF_LEN_BYTES] = {};
+    uint8_t ack_len = 0;
+    msg_parser_build_rx_ack(p_session, ack, sizeof(ack), &ack_len);
+
+    if ((ack_len != (EXT_ACK_PREFIX_SIZE_IN_BYTES + OTA_METRICS_SUMMARY_LEN_BYTES)) || (ack[1] != STATUS_ACK_TYPE))
+    {
+        fprintf(stderr, "Status query rejected\n");
+        return;
+    }
+
+    const uint8_t *p_summary = ack + EXT_ACK_PREFIX_SIZE_IN_BYTES;
+    const uint8_t *p_phase = p_summary + 13U;
+    const uint8_t *p_hist = p_phase + (OTA_METRICS_PHASE_COUNT * 12U);
+
+    printf("Metrics: state %u, %u us, min free heap %u bytes\n", p_summary[0],
+           get_u32_le(p_summary + 5U), get_u32_le(p_summary + 9U));
+
+    for (uint8_t i = 0; i < OTA_METRICS_PHASE_COUNT; i++, p_phase += 12U)
+    {
+        printf("  %-10s total %8u us, count %5u, max %7u us\n", phase_names[i],
+               get_u32_le(p_phase), get_u32_le(p_phase + 4U), get_u32_le(p_phase + 8U));
+    }
+
+    printf("  write latency:");
+    for (uint8_t i = 0; i < OTA_METRICS_WRITE_HIST_BUCKETS; i++)
+    {
+        printf(" %s %u", bucket_names[i], get_u32_le(p_hist + (4U * i)));
+    }
+    printf("\n");
+}
+
+static void put_u32_le(uint8_t * p_data, const uint32_t value)
+{
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        p_data[i] = (uint8_t)(value >> (8U * i));
+    }
+}
+
+static uint32_t get_u32_le(const uint8_t * p_data)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = 0; i < sizeof(value); i++)
+    {
+        value |= ((uint32_t)p_data[i]) << (8U * i);
+    }
+
+    return value;
+}
+
+static void print_usage(const char * name)
+{
+    fprintf(stderr,
+            "Usage: %s [-f flash.bin] [-i image.bin | -s size] [-c chunk] [-x | -b] [-l]\n"
+            "  -f  Simulated flash file, created erased when missing (default ota_flash.bin)\n"
+            "  -i  Image to send, a synthetic image is generated otherwise\n"
+            "  -s  Synthetic image size in bytes (default %u)\n"
+            "  -c  Bytes per msg_parser_run call (default %u)\n"
+            "  -x  Use the extended header with windowed acks\n"
+            "  -b  Send the block hash list, then only the blocks the device requests (extended header)\n"
+            "  -l  Simulate typical SPI flash erase and program latency\n",
+            name, DEFAULT_SYNTHETIC_SIZE_BYTES, DEFAULT_CHUNK_LEN_BYTES);
+}
@@ -7,6 +7,7 @@
 #include "wifi_ap.h"
 #include "tcp_tls.h"
 #include "ota_manager.h"
+#include "ota_hash_cache.h"
 #include "sys_feedback.h"
 
 
@@ -52,6 +53,16 @@ void app_main(void)
     
     wifi_ap_init();
     ESP_LOGI(tag, "----- wifi_ap: OK -----");
+
+    /* Only saves hashing on demand, the firmware is still healthy without it */
+    if (ota_hash_cache_init() != ERR_CODE_OK)
+    {
+        ESP_LOGW(tag, "----- ota_hash_cache: disabled -----");
+    }
+    else
+    {
+        ESP_LOGI(tag, "----- ota_hash_cache: OK -----");
+    }
     
     if (tcp_tls_init() != ERR_CODE_OK)
     {